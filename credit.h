@@ -8,7 +8,12 @@
 */
 #include <SDL2/SDL.h>  // Ensure SDL2 is included here for SDL_Renderer
 #include <SDL2/SDL_ttf.h>
-#define MAPSIZE 11
+#include <pthread.h>
+#define MAPSIZE 16
+#define MAX_LOAD 0.85
+#define MAX_PROBE 64
+#define MAP_SHARD_BITS 6
+#define MAP_SHARDS (1 << MAP_SHARD_BITS)
 #define RESET "\033[0m"
 #define RED "\033[31m"
 #define GREEN "\033[32m"
@@ -17,6 +22,44 @@
 #define WIDTH 800
 #define HEIGHT 600
 #define epsilon 1e-6
+#define SPLIT_BEST -1
+#define SPLIT_SCALAR 1
+#define SPLIT_SSE2 2
+#define SPLIT_AVX2 3
+#define KERNEL_BEST -1
+#define KERNEL_SCALAR 1
+#define KERNEL_AVX2 3
+#define KERNEL_AVX512 4
+#define FEAT_BUCKET 3
+#define FEAT_OUTLIER 4
+#define FEAT_ODD 8
+#define FEAT_PART_SHIFT 4
+#define FEAT_FAILED_RUN 64
+#define RULE_OUTLIER 1
+#define RULE_ODD 2
+#define RULE_FAILED 4
+#define RULE_FREQUENT 8
+#define RULE_LOCATION 16
+#define RULE_TRAVEL 32
+#define FEAT_TRAVEL 128
+#define EARTH_RADIUS_KM 6371.0
+#define PART_ODD 0
+#define PART_DAY 1
+#define PART_EVENING 2
+#define INDEX_MAGIC 0x58444955
+#define INDEX_VERSION 1
+#define INDEX_DIRECT 0x80000000u
+#define INDEX_MAX_TRIES 10000000
+#define INDEX_MAX_SEEDS 64
+#define CACHE_BUDGET_MB 256
+#define ARENA_CHUNK (64 * 1024)
+#define ARENA_MAX_CHUNK (16 * 1024 * 1024)
+#define SNAP_MAGIC 0x50414e53
+#define SNAP_VERSION 4
+#define DICT_NAME 32
+#define DICT_PAGE 256
+#define DICT_PAGES 4096
+#define LOC_ANY -2
 
 typedef struct countLoc{
 	int fin;
@@ -74,33 +117,110 @@ typedef struct location {
 	
 }location;
 
+/* A place as interned ids into the global location table (-1 = not in the table), see internLocation.
+*/
+typedef struct locId {
+
+	int city;
+	int state;
+	int country;
+	
+}locId;
+
 typedef struct node {
 
 	char transaction_id[40];
 	date date_of_payment;
 	struct tm time_of_payment;
-	location payment_place;
+	locId payment_place;
 	int zipCode;
 	float amount;
 	char status; 
-	int fraud;
+	long long epoch;
 	struct node *prev;
 	struct node *next;
 	
 }node;
 
+/* Per-user arena : a list of chunks that allocations are carved from by bumping used.
+*/
+typedef struct arenaChunk {
+
+	struct arenaChunk *next;
+	size_t size;
+	size_t used;
+	char data[];
+	
+}arenaChunk;
+
+typedef struct arena {
+
+	arenaChunk *chunks;
+	size_t chunkSize;
+	long reserved;
+	long allocations;
+	
+}arena;
+
 typedef struct dll {
 	
 	node *head;
 	node *end;
+	arena *pool;	// where new nodes are allocated, NULL for malloc
 	
 }dll;
 
+typedef struct loadStats {
+
+	long bytes;
+	long rows;
+	double seconds;
+	int source;	// 1 snapshot, 0 csv, -1 not loaded
+	
+}loadStats;
+
+/* Binary snapshot of a user's history (<Name>.snap) :
+* snapHeader, then count packed snapRecords in list order, then count ints (the date index, 
+* positions of the records sorted by date).
+*/
+typedef struct snapHeader {
+
+	unsigned int magic;
+	unsigned int version;
+	long long csvSize;
+	long long csvMtime;
+	long long count;
+	double mean;
+	double stdDev;
+	long long recordOffset;
+	long long indexOffset;
+	long long stringOffset;
+	long long stringCount;
+	
+}snapHeader;
+
+typedef struct snapRecord {
+
+	char transaction_id[40];
+	date date_of_payment;
+	unsigned char hour;
+	unsigned char min;
+	unsigned char sec;
+	char status;
+	locId payment_place;	// ids into the snapshot's own string table
+	int zipCode;
+	float amount;
+	long long epoch;
+	
+}snapRecord;
+
+typedef const char *(*rowSplitter)(const char *p, const char *end, const char **commas, int *n);
+
 typedef struct transaction {
 	
 	date date_of_payment;
 	struct tm time_of_payment;
-	location payment_place;
+	locId payment_place;
 	float amount;
 	char status; 
 	struct transaction *left;
@@ -118,49 +238,420 @@ typedef struct user {
 	location address;
 }user;
 
+/* Minimal perfect hash index of the cardholders (users.idx) : 
+* indexHeader, buckets displacement words, then count user records in slot order (64 byte aligned).
+*/
+typedef struct indexHeader {
+
+	unsigned int magic;
+	unsigned int version;
+	long long count;
+	long long buckets;
+	unsigned long long seed;
+	long long sourceSize;
+	long long sourceMtime;
+	long long dispOffset;
+	long long recordOffset;
+	
+}indexHeader;
+
+typedef struct userIndex {
+
+	const char *base;
+	size_t size;
+	const indexHeader *header;
+	const unsigned int *disp;
+	const user *records;
+	
+}userIndex;
+
+/* Interned strings : the string with id is pages[id / DICT_PAGE][id % DICT_PAGE], slots is an open addressing table of id + 1 (0 = empty).
+* A page is never moved once allocated, so a name stays valid while other threads intern.
+*/
+typedef struct strDict {
+
+	char (*pages[DICT_PAGES])[DICT_NAME];
+	int count;
+	int *slots;
+	int slotCap;
+	pthread_rwlock_t lock;
+	
+}strDict;
+
+/* Posting list of one place : the positions (in the columns) of the transactions made there, in ascending order.
+* A key field set to LOC_ANY matches every value, so (LOC_ANY, state, country) lists a whole state.
+*/
+typedef struct posting {
+
+	locId key;
+	int *pos;
+	int count;
+	int cap;
+	
+}posting;
+
+/* Inverted index of the places of one history, open addressing on the key (pos == NULL = empty slot).
+*/
+typedef struct placeIndex {
+
+	posting *slots;
+	int size;
+	int used;
+	long bytes;
+	
+}placeIndex;
+
+/* Totals of a set of transactions. failed counts failed transactions, flagged the ones flagged by the rule stage.
+*/
+typedef struct rollup {
+
+	long long count;
+	double sum;
+	double sumSq;
+	long long failed;
+	long long flagged;
+	
+}rollup;
+
+/* Per day or per month totals as prefix sums : prefix[b] is the total of buckets [0, b), so a range of buckets costs 
+* one subtraction. Bucket 0 is period first (day number since 01-01-1970, or year * 12 + month - 1).
+*/
+typedef struct rollupTable {
+
+	long first;
+	long buckets;
+	long capacity;
+	rollup *prefix;
+	
+}rollupTable;
+
+/* Columnar copy of a history, one array per field the fraud scans read. row[i] is the list node of transaction i.
+*/
+typedef struct txColumns {
+
+	long count;
+	long capacity;
+	float *amount;
+	long long *epoch;
+	unsigned char *hour;
+	char *status;
+	int *country;
+	int *state;
+	int *zipSlot;	// slot of the zip code in the zip code table
+	unsigned char *fraud;
+	node **row;
+	placeIndex places;
+	rollupTable days;
+	rollupTable months;
+	
+}txColumns;
+
+/* Static date index of a loaded history, in Eytzinger (BFS) layout : keys[1..count] are the packed yyyymmdd dates 
+* laid out as an implicit complete binary tree (children of k at 2k and 2k + 1), rank[k] is the position of keys[k] 
+* in date order and order[r] the column position of the r-th transaction in date order.
+*/
+typedef struct dateIndex {
+
+	int *keys;
+	int *rank;
+	int *order;
+	long count;
+	
+}dateIndex;
+
+/* AVL tree of the transactions appended since the load, keyed by date (equal dates in order of arrival), 
+* pos is the column position of the transaction.
+*/
+typedef struct dateNode {
+
+	int key;
+	int pos;
+	int height;
+	struct dateNode *left;
+	struct dateNode *right;
+	
+}dateNode;
+
+/* Order statistic AVL tree over the amounts of the successful transactions : size is the number of amounts in the subtree, 
+* which gives rank, select and range counts in O(logN).
+*/
+typedef struct amountNode {
+
+	float amount;
+	int size;
+	int height;
+	struct amountNode *left;
+	struct amountNode *right;
+	
+}amountNode;
+
+/* Iterator over the transactions of a history between two dates, in date order : 
+* merges the run [rank, rankEnd) of the date index with an in-order walk (explicit stack) of the appended tree.
+*/
+typedef struct dateCursor {
+
+	const struct item *owner;
+	long rank;
+	long rankEnd;
+	int to;
+	int depth;
+	dateNode *stack[64];
+	
+}dateCursor;
+
+/* Rolling spending profile : ring buffer of the successful amounts in the window (last N transactions or last N days), 
+* with their running sum and sum of squares. Amounts are kept in integer units of 1/10000, 
+* so adding and evicting never accumulates rounding error.
+*/
+typedef struct spendProfile {
+
+	long long *units;
+	long long *epoch;
+	long capacity;
+	long head;
+	long count;
+	long long sum;
+	__int128 sumSq;
+	
+}spendProfile;
+
+/* Per transaction features of a history, computed in one pass by the feature kernel : the z-score and a packed byte of 
+* z-bucket (flags & FEAT_BUCKET : 0 |z| <= 1.5, 1 |z| <= 3, 2 |z| > 3), FEAT_OUTLIER (|z| >= 3), FEAT_ODD (odd hour) 
+* the part of the day ((flags >> FEAT_PART_SHIFT) & 3 : PART_ODD, PART_DAY or PART_EVENING) and FEAT_FAILED_RUN 
+* (3 or more consecutive failures start here) and FEAT_TRAVEL (too fast from the previous place). burst is the number of following payments each within 5 minutes of the previous one.
+* rules is the verdict of every rule (RULE_*), a transaction is flagged when any is set. flagged and the Naive Bayes 
+* counts are tallied from it in the same stage.
+*/
+typedef struct txFeatures {
+
+	long count;
+	long capacity;
+	int valid;
+	float *z;
+	unsigned char *flags;
+	int *burst;
+	unsigned char *rules;
+	float *km;	// great circle distance from the previous transaction, NaN for an unknown zip code
+	long flagged;
+	countAmt amt;
+	countLoc loc;
+	countTime time;
+	countStatus st;
+	
+}txFeatures;
+
+/* The thresholds of the fraud rules, read from the rule config file (rules.conf by default). hourFlags is compiled 
+* from the hour settings : the FEAT_ODD and part of the day bits of every hour.
+*/
+typedef struct ruleConfig {
+
+	float outlierZ;		// RULE_OUTLIER at |z| >= outlierZ
+	float bucketLow;	// Naive Bayes z buckets : |z| <= bucketLow, <= bucketHigh, above
+	float bucketHigh;
+	int oddBefore;		// odd hours : before oddBefore or after oddAfter
+	int oddAfter;
+	int dayAfter;		// day : after dayAfter and before dayBefore, evening otherwise
+	int dayBefore;
+	long long burstSeconds;	// payments closer than this are part of a burst
+	int failedRun;		// consecutive failures for RULE_FAILED
+	int frequentRun;	// following payments in a burst for RULE_FREQUENT
+	float maxSpeed;		// km/h, RULE_TRAVEL when the move from the previous transaction needs more
+	float minTravel;	// km, shorter moves never count as impossible travel (same city, nearby zip codes)
+	int enabled;		// RULE_* bits in use
+	char homeCountry[32];
+	unsigned char hourFlags[24];
+	
+}ruleConfig;
+
+/* Zip code -> coordinates, sorted by zip code. x, y and z are the unit vectors of the places; 
+* one more slot than count, the unknown place (NaN).
+*/
+typedef struct zipTable {
+
+	int count;
+	int *zip;
+	float *x;
+	float *y;
+	float *z;
+	float *lat;
+	float *lon;
+	
+}zipTable;
+
+typedef void (*travelKernel)(const int *slot, long n, float *chord);
+
+typedef void (*featureKernel)(const float *amount, const unsigned char *hour, long n, float mean, float stdDev, int computeZ, float *z, unsigned char *flags);
+
 typedef struct item {
 
 	user client;
 	float stdDev;
 	float mean;
 	dll list;
-	transaction *root;
+	dateIndex dates;
+	dateNode *recent;	// transactions appended since the load, the dates index covers the rest
+	amountNode *amounts;
+	spendProfile profile;	// the window ending at the latest transaction, only kept when a window is configured
+	txFeatures features;	// shared by fraudAlert, flag, findFreq and detectFraud until the history changes
+	long csvBytes;
+	long statCount;
+	double runMean;
+	double runM2;
+	int loaded;
+	long memBytes;
+	long charged;
+	struct item *lruPrev;
+	struct item *lruNext;
+	arena *pool;
+	txColumns cols;
 	struct item *next;
 	
 }item;
 
+/* One slot of the open addressing map. dist is the probe length + 1 (0 = empty slot), 
+* the card number is kept in the slot so probing never has to dereference the item.
+*/
+typedef struct mapSlot {
+
+	long int cardNo;
+	unsigned int dist;
+	item *value;
+	
+}mapSlot;
+
 typedef struct Map {
 
-	item **array;
+	mapSlot *slots;
 	int size;
 	int count;
 	
 }Map;
 
+/* Lock-striped map for multi-threaded lookups : one Map and one read-write lock per shard, 
+* each shard on its own cache lines so that locking one does not slow down its neighbours.
+*/
+typedef struct mapShard {
+
+	pthread_rwlock_t lock;
+	Map *map;
+	
+} __attribute__((aligned(64))) mapShard;
+
+typedef struct ConcurrentMap {
+
+	mapShard shard[MAP_SHARDS];
+	
+}ConcurrentMap;
+
+typedef struct historyCache {
+
+	Map *map;
+	long budget;
+	long used;
+	item *mru;
+	item *lru;
+	long hits;
+	long misses;
+	long evictions;
+	
+}historyCache;
+
 char *getLine(FILE **fp); 
 
 Map *initHashMap();
 
-int hashfunction(long int card_no); 
+unsigned long long hashfunction(long int card_no); 
+
+int mapInsert(Map *h, long int cardNo, item *value);
 
 void enter_users(Map *h, user a);
 
 void readUsersData(Map *map, FILE **fp); 
 
+int parseUser(char *line, user *client);
+
 item *find(Map *map, long int no);
 
 char* checkPass(char *input); 
 
 int checkUser(Map *map, long int no, char *pass);
 
+void mapProbeStats(Map *map, double *mean, int *longest, long *hist, int buckets);
+
+void benchmarkMap(long n);
+
+ConcurrentMap *initConcurrentMap();
+
+item *cmapFind(ConcurrentMap *cm, long int no);
+
+int cmapCheckUser(ConcurrentMap *cm, long int no, char *pass);
+
+int cmapInsert(ConcurrentMap *cm, long int no, item *value);
+
+void cmapEnterUser(ConcurrentMap *cm, user a);
+
+void benchmarkConcurrentMap(long n, int maxThreads);
+
+int writeUserIndex(const user *users, long n, const char *indexName, long long sourceSize, long long sourceMtime);
+
+long buildUserIndex(const char *usersName, const char *indexName);
+
+userIndex *openUserIndex(const char *indexName, const char *usersName);
+
+void closeUserIndex(userIndex *ix);
+
+const user *indexFind(userIndex *ix, long int no);
+
+int indexCheckUser(userIndex *ix, long int no, char *pass);
+
+void benchmarkUserIndex(long n);
+
 void init_dll(dll *list);
 
-node* createNode(char *id, date payment_date, struct tm payment_time, location payment_place, int zip_code, float amount, char status);
+node* createNode(char *id, date payment_date, struct tm payment_time, locId payment_place, int zip_code, float amount, char status);
 
 void insertEnd(dll* list, node* newNode);
 
 void readCsv(dll *list, FILE **fp); 
 
+double nowSeconds();
+
+int parseRow(const char *p, const char *e, node *out);
+
+int setRowSplitter(int level);
+
+int readCsvMmap(dll *list, const char *fileName, loadStats *stats);
+
+double throughputMBps(loadStats stats);
+
+arena *arenaCreate(size_t chunkSize);
+
+void *arenaAlloc(arena *a, size_t n);
+
+void arenaDestroy(arena *a);
+
+transaction *buildDateBST(arena *pool, dll list, long count);
+
+void buildDateIndex(dateIndex *idx, const int *keys, int *order, long count);
+
+void indexListDates(dateIndex *idx, dll list, long count);
+
+long dateIndexLowerBound(const dateIndex *idx, int key);
+
+void freeDateIndex(dateIndex *idx);
+
+long dateIndexBytes(const dateIndex *idx);
+
+void benchmarkDateIndex(long count, long queries);
+
+void benchmarkArena(const char *csvName);
+
+void freeList(dll *list);
+
+void benchmarkParsers(const char *csvName, int rounds);
+
+int selfTest(void);
+
 node *copyList(dll list); 
 
 node* findMiddle(node *head); 
@@ -171,6 +662,146 @@ float calculateMean(dll *list);
 
 float calculateStandardDeviation(dll *list); 
 
+int dateKey(date d);
+
+int writeSnapshot(item *endUser, const char *csvName, const char *snapName);
+
+int readSnapshot(item *endUser, const char *csvName, const char *snapName, loadStats *stats);
+
+int loadUserHistory(item *endUser, loadStats *stats);
+
+long bulkLoad(Map *map, int threads);
+
+long fraudSweep(Map *map, const char *output, int maxThreads);
+
+void seedRunningStats(item *endUser);
+
+void updateRunningStats(item *endUser, node *newNode);
+
+dateNode *dateTreeInsert(arena *pool, dateNode *root, int key, int pos);
+
+void freeDateTree(dateNode *root);
+
+amountNode *buildAmountTree(arena *pool, txColumns *cols);
+
+amountNode *amountTreeInsert(arena *pool, amountNode *root, float amount);
+
+void freeAmountTree(amountNode *root);
+
+long amountCountBelow(amountNode *root, float amount, int inclusive);
+
+long amountRangeCount(amountNode *root, float low, float high);
+
+float amountSelect(amountNode *root, long k);
+
+float amountPercentile(amountNode *root, double p);
+
+void dateRangeOpen(dateCursor *cur, const struct item *endUser, date from, date to);
+
+node *dateRangeNext(dateCursor *cur);
+
+long appendCsvRows(item *endUser, const char *csvName);
+
+void followCsv(item *endUser);
+
+void freeTree(transaction *root);
+
+int dictLookup(strDict *d, const char *str, int len);
+
+int dictIntern(strDict *d, const char *str, int len);
+
+const char *dictName(strDict *d, int id);
+
+int internLocation(const char *str, const char *end);
+
+int findLocation(const char *str);
+
+const char *locationName(int id);
+
+locId findPlace(location place);
+
+int locationCount(void);
+
+void columnsAppend(txColumns *cols, node *newNode);
+
+void buildColumns(txColumns *cols, dll list, long count);
+
+void freeColumns(txColumns *cols);
+
+long columnsBytes(txColumns *cols);
+
+void columnStats(txColumns *cols, float *mean, float *stdDev);
+
+void flagRollups(txColumns *cols, const unsigned char *rules);
+
+void setProfileWindow(long transactions, long days);
+
+int profileEnabled(void);
+
+void profilePush(spendProfile *p, float amount, long long epoch);
+
+void profileExpire(spendProfile *p, long long now);
+
+long profileStats(const spendProfile *p, double *mean, double *stdDev);
+
+void freeProfile(spendProfile *p);
+
+void buildProfile(item *endUser);
+
+float *historyZScores(item *endUser);
+
+float liveZScore(item *endUser, float amount);
+
+int loadRuleConfig(const char *path);
+
+int loadZipTable(const char *path);
+
+int zipSlot(int zip);
+
+double zipDistance(int a, int b);
+
+void travelRuns(const txColumns *cols, float *km, unsigned char *flags);
+
+void benchmarkTravel(long count);
+
+const ruleConfig *ruleSettings();
+
+void benchmarkRules(long count);
+
+int setFeatureKernel(int level);
+
+const txFeatures *historyFeatures(item *endUser);
+
+void freeFeatures(txFeatures *f);
+
+void benchmarkFeatures(long count);
+
+void rollupAdd(rollupTable *table, long period, rollup delta);
+
+rollup rollupRange(const rollupTable *table, long fromPeriod, long toPeriod);
+
+void freeRollups(rollupTable *table);
+
+long dayNumber(date d);
+
+long monthNumber(date d);
+
+void printRollup(const char *label, rollup r);
+
+void spendBetween(item *endUser, date from, date to);
+
+void monthlySummary(item *endUser);
+
+void freeHistory(item *endUser);
+
+historyCache *initHistoryCache(Map *map, long budget);
+
+item *cacheFind(historyCache *c, long int no, loadStats *stats);
+
+void printCacheStats(historyCache *c);
+
+void serveCards(historyCache *c);
+
 void printMenu(); 
 
 int getInput(int num, dll list, item *endUser);
@@ -198,15 +829,41 @@ void renderText(SDL_Renderer *renderer, TTF_Font *font, const char *text, int x,
 
 void find_transactions_by_date(transaction *root, date target_date, int *count);
 
-void find_transactions_byLocation(dll list, location place);
+void find_history_by_date(item *endUser, date target_date, int *count);
 
-int is_small_time_frame(struct tm last_time, struct tm current_time); 
+void find_history_between(item *endUser, date from, date to, int *count);
+
+void placeIndexAdd(placeIndex *index, locId key, int pos);
+
+posting *placeIndexFind(placeIndex *index, locId key);
+
+void freePlaceIndex(placeIndex *index);
+
+void find_transactions_byLocation(item *endUser, location place);
+
+long long toEpoch(date d, struct tm t);
+
+int is_small_time_frame(long long last_time, long long current_time); 
 
 int frequent_trans(node *temp); 
 
-int is_location_anomaly(location current, location last, location home);
+int is_location_anomaly(locId current, locId last, locId home);
+
+int epochHour(long long epoch);
+
+int is_odd_epoch(long long epoch);
+
+int failedRunAt(txColumns *cols, long i);
+
+int frequentAt(txColumns *cols, long i);
+
+void ruleRuns(const txColumns *cols, unsigned char *flags, int *burst);
+
+void benchmarkBursts(long count, long burst);
+
+int locationAnomalyAt(txColumns *cols, long i, int homeCountry, int homeState);
 
-void fraudAlert(dll list, item *endUser); 
+void fraudAlert(item *endUser); 
 
 int *flag(item *endUser);
 
@@ -4,6 +4,18 @@
 #include"credit.h"
 #include <string.h>
 #include<math.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <malloc.h>
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
@@ -30,23 +42,16 @@ char *getLine(FILE **fp) {
 	return line;
 }
 
-/*The function initHashMap initializes and returns a new hash map data structure.
-* Dynamic Allocation of the Hash Map Structure:
-* Time complexity : 
-* Allocating the Map structure: O(1).
-* Allocating the array of item* pointers: O(MAPSIZE).
-* Overall Time Complexity: O(MAPSIZE).
+/*The function initHashMap initializes and returns a new, empty hash map.
+* The table starts with MAPSIZE slots (a power of two) and grows by doubling in enter_users, 
+* so it is not limited to a fixed number of cardholders.
+* Time complexity : O(MAPSIZE).
 */
 Map *initHashMap() {
 	
 	Map *hashmap;
 	hashmap = (Map*)malloc(sizeof(Map));
-	hashmap->array = (item**)malloc(sizeof(item*)*MAPSIZE);
-	
-	for(int i = 0; i < MAPSIZE; i++) {
-		hashmap->array[i] = NULL;
-	}
-	
+	hashmap->slots = (mapSlot*)calloc(MAPSIZE, sizeof(mapSlot));
 	hashmap->size = MAPSIZE;
 	hashmap->count = 0;
 	
@@ -56,50 +61,123 @@ Map *initHashMap() {
 
 /**
  * Function: 
- * Computes a hash value for a given credit card number to map it to an index in the hash table.
- * The function processes the card number in chunks of 4 digits, mixes the chunks using a prime multiplier (37), 
- * and ensures the resulting hash value fits within the hash table size (MAPSIZE).
- * This approach helps distribute card numbers uniformly across the hash table.
- * Time complexity : 
- * If the card number has dd digits, the number of iterations is proportional to ⌈d/4⌉⌈d/4⌉, which simplifies to O(d).
- * Each operation inside the loop (%, +, *, /) is O(1).
- * The final modulo operation is O(1).
- * Overall Time complexity - O(d). 
+ * Computes a 64 bit hash for a credit card number (the splitmix64 finalizer).
+ * Every bit of the card number affects every bit of the result, so card numbers that share long prefixes 
+ * or differ only in their last digits still spread evenly over the table. The slot is hash & (size - 1).
+ * Time complexity : O(1).
  */
 
-int hashfunction(long int card_no) {
+unsigned long long hashfunction(long int card_no) {
 
-    unsigned long long a = card_no;
-    unsigned long long hash = 0;
+    unsigned long long hash = (unsigned long long)card_no;
 
-    while (a > 0) {
-        hash += (a % 10000);    // Extract last 4 digits
-        hash *= 37;             // Mix with a prime multiplier
-        a /= 10000;             // Remove processed digits
-    }
+    hash += 0x9e3779b97f4a7c15ULL;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    
+    return hash ^ (hash >> 31);
+}
+
+/* Places an entry into a slot array of the given size (a power of two) with Robin Hood probing :
+ * while probing, an entry that is closer to its home slot than the one being inserted gives up its slot 
+ * and continues the probe instead. This keeps the probe lengths of all entries close to the average.
+ * dist stores the probe length + 1, 0 marks an empty slot.
+ * Returns 0 once an entry has been placed. If some entry would have to probe further than MAX_PROBE, 
+ * returns -1 and leaves that (still homeless) entry in *carry, so the caller can grow the table and place it there.
+ */
+static int robinHoodPlace(mapSlot *slots, int size, mapSlot *carry) {
+	
+	unsigned int mask = size - 1;
+	unsigned int idx = hashfunction(carry->cardNo) & mask;
+	
+	carry->dist = 1;
+	
+	while(1) {
+		
+		mapSlot *slot = &slots[idx];
+		
+		if(slot->dist == 0) {
+			*slot = *carry;
+			return 0;
+		}
+		
+		if(slot->dist < carry->dist) {
+			mapSlot tmp = *slot;
+			*slot = *carry;
+			*carry = tmp;
+		}
+		
+		carry->dist++;
+		if(carry->dist > MAX_PROBE) return -1;
+		
+		idx = (idx + 1) & mask;
+	}
+}
+
+/* Moves every entry into a table of at least newSize slots, doubling again if a probe still runs past MAX_PROBE.
+ * Time complexity : O(size).
+ */
+static void rehashMap(Map *h, int newSize) {
+	
+	while(1) {
+		
+		mapSlot *slots = (mapSlot*)calloc(newSize, sizeof(mapSlot));
+		int ok = 1;
+		
+		for(int i = 0; i < h->size && ok; i++) {
+			if(h->slots[i].dist != 0) {
+				mapSlot carry = h->slots[i];
+				ok = robinHoodPlace(slots, newSize, &carry) == 0;
+			}
+		}
+		
+		if(ok) {
+			free(h->slots);
+			h->slots = slots;
+			h->size = newSize;
+			return;
+		}
+		
+		free(slots);
+		newSize *= 2;
+	}
+}
 
-    // Ensure the hash value fits within the hash table size
-    return (unsigned int)(hash % MAPSIZE);   
+/* Inserts value under cardNo, growing the table when the load factor would pass MAX_LOAD or a probe 
+ * would pass MAX_PROBE. A card number that is already present is left as it is.
+ * Returns 1 if the entry was added, 0 if the card number was already in the map.
+ * Time complexity : amortized O(1).
+ */
+int mapInsert(Map *h, long int cardNo, item *value) {
+	
+	if(find(h, cardNo) != NULL) {
+		return 0;
+	}
+	
+	if(h->count + 1 > h->size * MAX_LOAD) {
+		rehashMap(h, h->size * 2);
+	}
+	
+	mapSlot carry = {cardNo, 0, value};
+	
+	while(robinHoodPlace(h->slots, h->size, &carry) == -1) {
+		rehashMap(h, h->size * 2);	// every entry but carry is still in the table
+	}
+	
+	h->count++;
+	return 1;
 }
 
 /**
- * Inserts a new user into the hash map using quadratic probing for collision resolution.
- * It calculates the hash index for the user's credit card number and creates a new item 
- * containing the user's details, including name, card number, CVV, expiry date, address, and password.
- * The function attempts to place the item in the hash table, and if collisions occur, it uses 
- * quadratic probing to find the next available slot within the table.
- * Load Factor : Number of elements in the map / size of the map ( in this case is 0.4).
- * With a low load factor, the chance of collisions is significantly reduced. 
- * Most insertions will occur directly at the computed hash index, making insertion operations faster.
- * Time Complexity :
- * Average Case: O(1) for a well-distributed hash function and low load factor.
- * Worst Case: O(MAPSIZE) if the table is nearly full or the hash function causes clustering.
+ * Inserts a new user into the hash map.
+ * It creates a new item containing the user's details, including name, card number, CVV, expiry date, address, and password,
+ * and stores it under the card number with mapInsert (Robin Hood probing, automatic rehashing).
+ * A user whose card number is already in the map is ignored.
+ * Time Complexity : amortized O(1).
  */
 
 void enter_users(Map *h, user a) {
 	
-	int idx = hashfunction(a.cardNo);
-	
 	item *new_item = (item*)malloc(sizeof(item));
 	
 	strcpy(new_item->client.name, a.name);
@@ -112,25 +190,27 @@ void enter_users(Map *h, user a) {
         strcpy(new_item->client.address.country, a.address.country);
         strcpy(new_item->client.address.state, a.address.state);
         strcpy(new_item->client.address.city, a.address.city);
-        new_item->root = NULL;
+        new_item->recent = NULL;
+        new_item->amounts = NULL;
+        memset(&(new_item->profile), 0, sizeof(new_item->profile));
+        memset(&(new_item->dates), 0, sizeof(new_item->dates));
         new_item->next = NULL;
-
-	item** arr = h->array;
-		
-	// using quadratic probing for this : 	
-	int i = 0;
-	
-	while (i < MAPSIZE) {
-		unsigned int probeIndex = (idx + i * i) % MAPSIZE;
-		if (arr[probeIndex] == NULL) { // Slot is empty
-		    arr[probeIndex] = new_item;
-		    h->count++;
-		    return;
-		}
-		i++;
-    	}
-    	
-    	return;		
+        new_item->csvBytes = 0;
+        new_item->loaded = 0;
+        new_item->memBytes = 0;
+        new_item->charged = 0;
+        new_item->lruPrev = NULL;
+        new_item->lruNext = NULL;
+        new_item->pool = NULL;
+        memset(&(new_item->cols), 0, sizeof(new_item->cols));
+        new_item->list.pool = NULL;
+        new_item->statCount = 0;
+        new_item->runMean = 0.0;
+        new_item->runM2 = 0.0;
+        
+        if(mapInsert(h, a.cardNo, new_item) == 0) {
+        	free(new_item);
+        }
 }
 
 /* Function: Reads user data from a file and populates the hash map with user details. 
@@ -173,46 +253,11 @@ void readUsersData(Map *map, FILE **fp) {
 			break;
 		}
 		
-		char *token = strtok(line, ",");
-		strncpy(client.name, token, sizeof(client.name) - 1);
-    		client.name[sizeof(client.name) - 1] = '\0';
-		
-		token = strtok(NULL, ",");
-		char *endptr;
-		client.cardNo = strtol(token, &endptr, 16);
-		if (*endptr != '\0') {
-			printf("Error: Invalid card number format\n");
+		if(parseUser(line, &client) == 0) {
 			free(line);
 			return;
 		}
 		
-		token = strtok(NULL, ",");
-		client.cvv = atoi(token);
-		
-		token = strtok(NULL, ",");
-		if (sscanf(token, "%d/%d/%d", &client.expiryDate.day, &client.expiryDate.month, &client.expiryDate.year) != 3) {
-        		printf("Error: Invalid expiry date format\n");
-        		free(line);
-        		return;
-    		}
-    		
-    		token = strtok(NULL, ",");
-		strncpy(client.password, token, sizeof(client.password) - 1);
-    		client.password[sizeof(client.password) - 1] = '\0';
-		
-		token = strtok(NULL, ",");
-		strncpy(client.address.country, token, sizeof(client.address.country) - 1);
-    		client.address.country[sizeof(client.address.country) - 1] = '\0';
-    		
-    		token = strtok(NULL, ",");
-		strncpy(client.address.state, token, sizeof(client.address.state) - 1);
-    		client.address.state[sizeof(client.address.state) - 1] = '\0';
-    		
-    		token = strtok(NULL, ",");
-		strncpy(client.address.city, token, sizeof(client.address.city) - 1);
-    		client.address.city[sizeof(client.address.city) - 1] = '\0';
-		
-		
 		enter_users(map, client);
 		free(line);
 	}	
@@ -220,6 +265,51 @@ void readUsersData(Map *map, FILE **fp) {
 	free(line);
 }	
 
+/* Tokenizes one line of users.csv (name, card number, cvv, expiry date, password, country, state, city) into client.
+ * The line is modified by strtok. Returns 1 on success, 0 if the card number or expiry date is malformed.
+ */
+int parseUser(char *line, user *client) {
+	
+	char *token = strtok(line, ",");
+	strncpy(client->name, token, sizeof(client->name) - 1);
+	client->name[sizeof(client->name) - 1] = '\0';
+	
+	token = strtok(NULL, ",");
+	char *endptr;
+	client->cardNo = strtol(token, &endptr, 16);
+	if (*endptr != '\0') {
+		printf("Error: Invalid card number format\n");
+		return 0;
+	}
+	
+	token = strtok(NULL, ",");
+	client->cvv = atoi(token);
+	
+	token = strtok(NULL, ",");
+	if (sscanf(token, "%d/%d/%d", &client->expiryDate.day, &client->expiryDate.month, &client->expiryDate.year) != 3) {
+		printf("Error: Invalid expiry date format\n");
+		return 0;
+	}
+	
+	token = strtok(NULL, ",");
+	strncpy(client->password, token, sizeof(client->password) - 1);
+	client->password[sizeof(client->password) - 1] = '\0';
+	
+	token = strtok(NULL, ",");
+	strncpy(client->address.country, token, sizeof(client->address.country) - 1);
+	client->address.country[sizeof(client->address.country) - 1] = '\0';
+	
+	token = strtok(NULL, ",");
+	strncpy(client->address.state, token, sizeof(client->address.state) - 1);
+	client->address.state[sizeof(client->address.state) - 1] = '\0';
+	
+	token = strtok(NULL, ",");
+	strncpy(client->address.city, token, sizeof(client->address.city) - 1);
+	client->address.city[sizeof(client->address.city) - 1] = '\0';
+	
+	return 1;
+}
+
 /**
  * This function is responsible for transforming the input password string by applying a transformation to each character.
  * The transformation modifies the ASCII value of each character based on a simple rule:
@@ -256,329 +346,5550 @@ char *checkPass(char *input) {
     return line; // Remember to free this memory after use in checkUser
 }
 
-/* Time complexity: 
- * Best Case:
- * The best-case scenario is when the item is found in the first slot, and no collisions occur, O(1).
- * Worst Case:
- * In the worst case, when all the slots are filled with items, the function might need to probe all the slots in the hash map, O(M).
- * (M is Hashmap size).
+/* Looks up a card number. The probe stops at an empty slot or at an entry that is closer to its home slot 
+ * than the key would be at this point : with Robin Hood placement the key can not be further along.
+ * Time complexity : O(1) expected, at most MAX_PROBE probes.
 */
 
 item *find(Map *map, long int no) {
 	
-    int idx = hashfunction(no);
-    int i = 0;
-    while(i < MAPSIZE) {
+    unsigned int mask = map->size - 1;
+    unsigned int idx = hashfunction(no) & mask;
+    unsigned int dist = 1;
+    
+    while(1) {
     	
-    	unsigned int probeIndex = (idx + i * i) % map->size;
+    	mapSlot *slot = &map->slots[idx];
     	
-    	if (map->array[probeIndex] == NULL) {
+    	if(slot->dist < dist) {
             break;  // User not found
         }
 	
-	item *currentItem = map->array[probeIndex];
-	if(currentItem->client.cardNo == no) {
-		return currentItem;
+	if(slot->cardNo == no) {
+		return slot->value;
 	}
 	
-	i++;
+	dist++;
+	idx = (idx + 1) & mask;
     }
 
     return NULL; 
 }
 
 /* This function checks if a user exists in the hash map and if the provided password matches the stored password.
- * Time complexity :
- * Worst-case time complexity: O(M+L).
- * Best-case time complexity: O(L) (when the user is found in the first probe and no collisions occur).
-
- * Where:
-
-    M is the size of the hash map (number of slots).
-    L is the length of the password.
+ * Time complexity : O(1) expected for the lookup, plus O(L) for the password (L is its length).
 */
 
 int checkUser(Map *map, long int no, char *pass) {
     
-    int idx = hashfunction(no);
-    int i = 0;
-    while(i < MAPSIZE) {
-    	
-    	unsigned int probeIndex = (idx + i * i) % map->size;
-    	
-    	if (map->array[probeIndex] == NULL) {
-            break;  // User not found
-        }
+    item *currentItem = find(map, no);
+    
+    if(currentItem == NULL) {
+    	return -1;  // Return -1 indicating "user not found"
+    }
+	
+    char *new = checkPass(pass);
+    // Compare the transformed password
+    if (strcmp(new, currentItem->client.password) == 0) {
+        free(new);  // Free the allocated memory for transformed password
+        return 1; 
+         // Password matched
+    } 
+    
+    else {
+        free(new);  // Free the allocated memory for transformed password
+        return 0;  // Incorrect password
+    }
+}
+
+/* Probe length statistics of the map : mean and longest probe, and a histogram of probe lengths 
+ * (hist[i] entries were found i slots after their home slot, the last bucket collects the rest).
+*/
+void mapProbeStats(Map *map, double *mean, int *longest, long *hist, int buckets) {
 	
-	item *currentItem = map->array[probeIndex];
-	if(currentItem->client.cardNo == no) {
+	long total = 0;
+	*longest = 0;
+	
+	for(int i = 0; i < buckets; i++) hist[i] = 0;
+	
+	for(int i = 0; i < map->size; i++) {
 		
-		char *new = checkPass(pass);
-		// Compare the transformed password
-            	if (strcmp(new, currentItem->client.password) == 0) {
-                	free(new);  // Free the allocated memory for transformed password
-                	return 1; 
-                	 // Password matched
-            	} 
-            	
-            	else {
-                	free(new);  // Free the allocated memory for transformed password
-                	return 0;  // Incorrect password
-            	}
+		int d = map->slots[i].dist;
+		if(d == 0) continue;
+		
+		d--;
+		total += d;
+		if(d > *longest) *longest = d;
+		hist[d < buckets ? d : buckets - 1]++;
 	}
 	
-	i++;
-    }
+	*mean = map->count > 0 ? (double)total / map->count : 0.0;
+}
+
+/* Benchmark of the cardholder map (./credit --bench-map [n]) : inserts n random 16 digit card numbers, 
+* looks every one of them up again and as many absent ones, and prints ns per operation, the final size and load factor 
+* and the probe length statistics. The entries all point to one shared item, only the table itself is measured.
+*/
+void benchmarkMap(long n) {
+	
+	Map *m = initHashMap();
+	item *dummy = (item*)calloc(1, sizeof(item));
+	long *cards = (long*)malloc(sizeof(long) * n);
+	unsigned long long x = 88172645463325252ULL;
+	
+	for(long i = 0; i < n; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		cards[i] = 4000000000000000L + (long)(x % 1000000000000000ULL);
+	}
+	
+	double start = nowSeconds();
+	for(long i = 0; i < n; i++) {
+		mapInsert(m, cards[i], dummy);
+	}
+	double insertTime = nowSeconds() - start;
+	
+	long found = 0;
+	start = nowSeconds();
+	for(long i = 0; i < n; i++) {
+		found += find(m, cards[i]) != NULL;
+	}
+	double hitTime = nowSeconds() - start;
+	
+	long missed = 0;
+	start = nowSeconds();
+	for(long i = 0; i < n; i++) {
+		missed += find(m, cards[i] + 1) == NULL;	// the generator never produces adjacent numbers in practice
+	}
+	double missTime = nowSeconds() - start;
+	
+	double mean;
+	int longest;
+	long hist[8];
+	mapProbeStats(m, &mean, &longest, hist, 8);
+	
+	printf("%ld cards, %d slots (load %.2f), %.1f MB\n", (long)m->count, m->size, (double)m->count / m->size, m->size * sizeof(mapSlot) / (1024.0 * 1024.0));
+	printf("insert : %7.1f ns/op\n", insertTime * 1e9 / n);
+	printf("hit    : %7.1f ns/op (%ld found)\n", hitTime * 1e9 / n, found);
+	printf("miss   : %7.1f ns/op (%ld absent)\n", missTime * 1e9 / n, missed);
+	printf("probe length : mean %.3f, max %d\n", mean, longest);
+	
+	for(int i = 0; i < 8; i++) {
+		printf("  %s%d : %ld\n", i == 7 ? ">=" : "", i, hist[i]);
+	}
+	
+	free(m->slots);
+	free(m);
+	free(dummy);
+	free(cards);
+}
 
-    return -1;  // Return -1 indicating "user not found"
+/* The concurrent map splits the card numbers over MAP_SHARDS independent Maps by the top bits of their hash 
+* (the slot inside a shard uses the low bits). Every shard has its own read-write lock, so lookups only take 
+* a shared lock and never block each other, and an insert only locks the one shard it goes to.
+* Items are never removed, so a pointer returned by cmapFind stays valid after the lock is released.
+*/
+ConcurrentMap *initConcurrentMap() {
+	
+	ConcurrentMap *cm = NULL;
+	
+	// malloc only promises 16 bytes, the shards need their 64 byte alignment to sit on their own cache lines
+	if(posix_memalign((void**)&cm, 64, sizeof(ConcurrentMap)) != 0) return NULL;
+	
+	for(int i = 0; i < MAP_SHARDS; i++) {
+		cm->shard[i].map = initHashMap();
+		pthread_rwlock_init(&cm->shard[i].lock, NULL);
+	}
+	
+	return cm;
 }
 
-void init_dll(dll *list) {
-	list->head = NULL;
-	list->end = NULL;
+static mapShard *shardOf(ConcurrentMap *cm, long int no) {
+	return &cm->shard[hashfunction(no) >> (64 - MAP_SHARD_BITS)];
 }
 
-node* createNode(char *id, date payment_date, struct tm payment_time, location payment_place, int zip_code, float amount, char status) {
-    
-    node* newNode = (node*)malloc(sizeof(node));
-    strcpy(newNode->transaction_id, id);
-    newNode->date_of_payment = payment_date;
-    newNode->time_of_payment = payment_time;
-    newNode->payment_place = payment_place;
-    newNode->zipCode = zip_code;
-    newNode->amount = amount;
-    newNode->status = status;
-    newNode->prev = NULL;
-    newNode->next = NULL;
-    newNode->fraud = 0;
-    
-    return newNode;
+item *cmapFind(ConcurrentMap *cm, long int no) {
+	
+	mapShard *sh = shardOf(cm, no);
+	
+	pthread_rwlock_rdlock(&sh->lock);
+	item *it = find(sh->map, no);
+	pthread_rwlock_unlock(&sh->lock);
+	
+	return it;
 }
 
-void insertEnd(dll* list, node* newNode) {
-    if (list->head == NULL) {
-        list->head = newNode;
-        list->end = newNode;
-    } 
-    
-    else {
-        list->end->next = newNode;
-        newNode->prev = list->end;
-        list->end = newNode;
-    }
+int cmapCheckUser(ConcurrentMap *cm, long int no, char *pass) {
+	
+	mapShard *sh = shardOf(cm, no);
+	
+	pthread_rwlock_rdlock(&sh->lock);
+	int result = checkUser(sh->map, no, pass);
+	pthread_rwlock_unlock(&sh->lock);
+	
+	return result;
 }
 
-void readCsv(dll *list, FILE **fp) {
+int cmapInsert(ConcurrentMap *cm, long int no, item *value) {
+	
+	mapShard *sh = shardOf(cm, no);
+	
+	pthread_rwlock_wrlock(&sh->lock);
+	int added = mapInsert(sh->map, no, value);
+	pthread_rwlock_unlock(&sh->lock);
+	
+	return added;
+}
 
-	char *line;
+/* Same as enter_users, on the concurrent map.
+*/
+void cmapEnterUser(ConcurrentMap *cm, user a) {
 	
-	// to skip the first line;
-	line = getLine(fp);
+	mapShard *sh = shardOf(cm, a.cardNo);
 	
-	while(1) {
+	pthread_rwlock_wrlock(&sh->lock);
+	enter_users(sh->map, a);
+	pthread_rwlock_unlock(&sh->lock);
+}
+
+typedef struct cmapBench {
 	
-		line = getLine(fp);
-		
-		if(strcmp(line, "") == 0 || line == NULL) {
-			break;
-		}
-		
-		char *token = strtok(line, ",");
-		char id[20];
-		strncpy(id, token, sizeof(id) - 1);
-		id[sizeof(id) - 1] = '\0'; // Ensure null-termination
-		
-		// Date
-		token = strtok(NULL, ",");
-		date payment_date;
-		sscanf(token, "%d-%d-%d", &payment_date.day, &payment_date.month, &payment_date.year);
+	ConcurrentMap *cm;
+	item *dummy;
+	const long *cards;
+	long n;
+	long ops;
+	int id;
+	long found;
+	
+}cmapBench;
+
+/* One benchmark thread : ops lookups of random known cards, with one insert of a new card every 1000 operations.
+*/
+static void *cmapBenchWorker(void *arg) {
+	
+	cmapBench *b = (cmapBench*)arg;
+	unsigned long long x = 0x2545F4914F6CDD1DULL * (b->id + 1);
+	long found = 0;	// the threads' structs share cache lines, so the count is stored once at the end
+	
+	for(long i = 0; i < b->ops; i++) {
 		
-		// Time
-		token = strtok(NULL, ",");
-		struct tm payment_time;
-		sscanf(token, "%d:%d:%d", &payment_time.tm_hour, &payment_time.tm_min, &payment_time.tm_sec);
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
 		
-		// City
-		token = strtok(NULL, ",");
-		location payment_place;
-		strncpy(payment_place.city, token, sizeof(payment_place.city) - 1);
-		payment_place.city[sizeof(payment_place.city) - 1] = '\0';
+		if(i % 1000 == 999) {
+			cmapInsert(b->cm, 9000000000000000L + (long)(x % 1000000000000000ULL), b->dummy);
+		}
 		
+		else {
+			found += cmapFind(b->cm, b->cards[x % b->n]) != NULL;
+		}
+	}
+	
+	b->found = found;
+	return NULL;
+}
+
+/* Contention benchmark of the concurrent map (./credit --bench-cmap [n] [maxThreads]) :
+* the map is filled with n cards, then 1, 2, 4 ... maxThreads threads each run 1M operations (99.9% lookups, 0.1% inserts)
+* and the total throughput is printed for every thread count.
+*/
+void benchmarkConcurrentMap(long n, int maxThreads) {
+	
+	ConcurrentMap *cm = initConcurrentMap();
+	item *dummy = (item*)calloc(1, sizeof(item));
+	long *cards = (long*)malloc(sizeof(long) * n);
+	unsigned long long x = 88172645463325252ULL;
+	long ops = 1000000;
+	
+	for(long i = 0; i < n; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		cards[i] = 4000000000000000L + (long)(x % 1000000000000000ULL);
+		cmapInsert(cm, cards[i], dummy);
+	}
+	
+	printf("%ld cards in %d shards, %ld operations per thread (0.1%% inserts)\n", n, MAP_SHARDS, ops);
+	
+	for(int threads = 1; threads <= maxThreads; threads *= 2) {
 		
-		 // State
-		token = strtok(NULL, ",");
-		strncpy(payment_place.state, token, sizeof(payment_place.state) - 1);
-		payment_place.state[sizeof(payment_place.state) - 1] = '\0'; // Ensure null-termination
+		pthread_t *pool = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+		cmapBench *args = (cmapBench*)calloc(threads, sizeof(cmapBench));
+		double start = nowSeconds();
 		
-		//country 
-		token = strtok(NULL, ",");
-		strncpy(payment_place.country, token, sizeof(payment_place.country) - 1);
-		payment_place.country[sizeof(payment_place.country) - 1] = '\0'; // Ensure null-termination
+		for(int t = 0; t < threads; t++) {
+			args[t].cm = cm;
+			args[t].dummy = dummy;
+			args[t].cards = cards;
+			args[t].n = n;
+			args[t].ops = ops;
+			args[t].id = t;
+			pthread_create(&pool[t], NULL, cmapBenchWorker, &args[t]);
+		}
 		
-		token = strtok(NULL, ",");
-        	int zip_code = atoi(token);
+		for(int t = 0; t < threads; t++) {
+			pthread_join(pool[t], NULL);
+		}
 		
-		// Amount
-		token = strtok(NULL, ",");
-		float amount = atof(token);
+		double wall = nowSeconds() - start;
+		printf("%3d threads : %8.2f Mops/s\n", threads, threads * ops / wall / 1e6);
 		
-		//status 
-		token = strtok(NULL, ",");
-        	char status = token[0];
-        	
-        	node* newNode = createNode(id, payment_date, payment_time, payment_place, zip_code, amount, status);
-        	insertEnd(list, newNode);
-        	
-        	free(line);
+		free(pool);
+		free(args);
 	}
 	
-	free(line);
+	for(int i = 0; i < MAP_SHARDS; i++) {
+		pthread_rwlock_destroy(&cm->shard[i].lock);
+		free(cm->shard[i].map->slots);
+		free(cm->shard[i].map);
+	}
+	
+	free(cm);
+	free(dummy);
+	free(cards);
 }
 
-/*Purpose :  To create a copy of the linked list, so that this could be used to create a binary search tree.
- * Time Complexity : O(N), where N is the number of elements in the doubly linked list.
+/* Static minimal perfect hash index of the cardholders (users.idx).
+* Built offline once users.csv changes (./credit --build-index), then only mapped at startup.
+*
+* Construction (hash and displace) : the n card numbers are spread over n/4 buckets by their hash. 
+* Buckets are placed largest first : for a bucket of two or more keys, displacements d = 0, 1, 2 ... are tried 
+* until every key of the bucket lands on a distinct free slot of slot(key, d) = mix(hash + d) % n, and d is stored.
+* A bucket with a single key simply takes the next free slot, stored directly as INDEX_DIRECT | slot.
+* Every one of the n slots ends up holding exactly one user record.
+*
+* Lookup : one bucket read to get d, one slot computation, one record compare - exactly one probe into the records.
 */
-node *copyList(dll list) {
-	node *temp = list.head;
-	node *p;
-	node dummy;
+
+static unsigned long long indexSlotHash(unsigned long long h, unsigned int d) {
+	return hashfunction((long)(h + d * 0x9e3779b97f4a7c15ULL));
+}
+
+static unsigned long long indexKeyHash(long cardNo, unsigned long long seed) {
+	return hashfunction(cardNo ^ (long)seed);
+}
+
+/* Builds the displacement table for n card numbers. Returns 0 on success, -1 if a bucket could not be placed 
+* (the caller retries with another seed).
+*/
+static int buildDisplacements(const long *cards, long n, long nb, unsigned long long seed, unsigned int *disp, long *slotOf) {
 	
-	p = &dummy;
+	long *start = (long*)calloc(nb + 1, sizeof(long));
+	long *keys = (long*)malloc(sizeof(long) * n);
+	long *order = (long*)malloc(sizeof(long) * nb);
+	unsigned long long *h = (unsigned long long*)malloc(sizeof(unsigned long long) * n);
+	unsigned char *taken = (unsigned char*)calloc(n, 1);
+	long slots[64];
+	int status = 0;
 	
-	while(temp != NULL) {
-		node *new = (node*)malloc(sizeof(node));
-		new->transaction_id[0] = temp->transaction_id[0];
-		new->time_of_payment = temp->time_of_payment;
-		new->payment_place = temp->payment_place;
-		new->zipCode = temp->zipCode;
-		new->amount = temp->amount;
-		new->status = temp->status;
-		new->date_of_payment = temp->date_of_payment;
+	// counting sort of the keys by bucket
+	for(long i = 0; i < n; i++) {
+		h[i] = indexKeyHash(cards[i], seed);
+		start[(h[i] >> 32) % nb + 1]++;
+	}
+	
+	long maxSize = 0;
+	for(long b = 0; b < nb; b++) {
+		if(start[b + 1] > maxSize) maxSize = start[b + 1];
+		start[b + 1] += start[b];
+	}
+	
+	long *fill = (long*)malloc(sizeof(long) * nb);
+	memcpy(fill, start, sizeof(long) * nb);
+	
+	for(long i = 0; i < n; i++) {
+		keys[fill[(h[i] >> 32) % nb]++] = i;
+	}
+	
+	// buckets largest first, again with a counting sort on the sizes
+	long *bySize = (long*)calloc(maxSize + 2, sizeof(long));
+	for(long b = 0; b < nb; b++) bySize[maxSize - (start[b + 1] - start[b]) + 1]++;
+	for(long k = 0; k <= maxSize; k++) bySize[k + 1] += bySize[k];
+	for(long b = 0; b < nb; b++) order[bySize[maxSize - (start[b + 1] - start[b])]++] = b;
+	
+	long nextFree = 0;
+	
+	for(long o = 0; o < nb && status == 0; o++) {
 		
-		p->next = new;
-		p = p->next;
-		temp = temp->next;
-	} 
+		long b = order[o];
+		long size = start[b + 1] - start[b];
+		
+		if(size == 0) {
+			disp[b] = 0;
+			continue;
+		}
+		
+		if(size == 1) {
+			while(taken[nextFree]) nextFree++;
+			taken[nextFree] = 1;
+			disp[b] = INDEX_DIRECT | (unsigned int)nextFree;
+			slotOf[keys[start[b]]] = nextFree;
+			continue;
+		}
+		
+		if(size > 64) {
+			status = -1;
+			break;
+		}
+		
+		unsigned int d = 0;
+		
+		while(1) {
+			
+			int ok = 1;
+			
+			for(long k = 0; k < size && ok; k++) {
+				
+				slots[k] = indexSlotHash(h[keys[start[b] + k]], d) % n;
+				if(taken[slots[k]]) ok = 0;
+				
+				for(long j = 0; j < k && ok; j++) {
+					if(slots[j] == slots[k]) ok = 0;
+				}
+			}
+			
+			if(ok) break;
+			
+			if(++d >= INDEX_MAX_TRIES) {
+				status = -1;
+				break;
+			}
+		}
+		
+		if(status == 0) {
+			disp[b] = d;
+			for(long k = 0; k < size; k++) {
+				taken[slots[k]] = 1;
+				slotOf[keys[start[b] + k]] = slots[k];
+			}
+		}
+	}
 	
-	p->next = NULL;
+	free(start);
+	free(keys);
+	free(order);
+	free(h);
+	free(taken);
+	free(fill);
+	free(bySize);
 	
-	return dummy.next;
-}	
+	return status;
+}
 
-/* The function findMiddle finds the middle node of a singly linked list, which is typically done using 
- * the tortoise and hare approach (using two pointers: slow and fast).
- * it takes half as many iterations to reach the end of the list as the total number of nodes.
- * The overall Time Complexity is O(N).
+typedef struct cardSlot {
+	
+	long cardNo;
+	long pos;
+	
+}cardSlot;
+
+static int compareCardSlots(const void *a, const void *b) {
+	
+	const cardSlot *x = (const cardSlot*)a, *y = (const cardSlot*)b;
+	
+	if(x->cardNo != y->cardNo) return (x->cardNo < y->cardNo) ? -1 : 1;
+	return (x->pos < y->pos) ? -1 : (x->pos > y->pos);
+}
+
+/* Marks in repeat every user whose card number already appeared earlier in users (the map keeps the first one too).
+* repeat may be NULL to only count them. Returns the number of repeated cards.
+* Time Complexity : O(NlogN).
 */
+static long repeatedCards(const user *users, long n, unsigned char *repeat) {
+	
+	cardSlot *sorted = (cardSlot*)malloc(sizeof(cardSlot) * (n > 0 ? n : 1));
+	long repeats = 0;
+	
+	for(long i = 0; i < n; i++) {
+		sorted[i].cardNo = users[i].cardNo;
+		sorted[i].pos = i;
+	}
+	
+	qsort(sorted, n, sizeof(cardSlot), compareCardSlots);
+	
+	for(long i = 0; i < n; i++) {
+		int seen = i > 0 && sorted[i].cardNo == sorted[i - 1].cardNo;
+		if(repeat != NULL) repeat[sorted[i].pos] = seen;
+		repeats += seen;
+	}
+	
+	free(sorted);
+	return repeats;
+}
 
-node* findMiddle(node *head) {
-    
-    if (head == NULL) return NULL;
-    node *slow = head;
-    node *fast = head;
-    node *prev = NULL;
+/* Writes the index file for the given users : header, displacement table, then the user records in slot order.
+* The card numbers must be distinct : two equal keys always share a bucket and a slot, no seed can place them.
+* Returns 0 on success, -1 on failure (a repeated card, or no seed out of INDEX_MAX_SEEDS worked).
+*/
+int writeUserIndex(const user *users, long n, const char *indexName, long long sourceSize, long long sourceMtime) {
+	
+	if(repeatedCards(users, n, NULL) > 0) return -1;
+	
+	long nb = n / 4 + 1;
+	unsigned int *disp = (unsigned int*)malloc(sizeof(unsigned int) * nb);
+	long *slotOf = (long*)malloc(sizeof(long) * (n > 0 ? n : 1));
+	long *cards = (long*)malloc(sizeof(long) * (n > 0 ? n : 1));
+	unsigned long long seed = 0;
+	int seeds = 0;
+	
+	for(long i = 0; i < n; i++) cards[i] = users[i].cardNo;
+	
+	while(buildDisplacements(cards, n, nb, seed, disp, slotOf) == -1) {
+		
+		if(++seeds >= INDEX_MAX_SEEDS) {
+			free(disp);
+			free(slotOf);
+			free(cards);
+			return -1;
+		}
+		
+		seed = hashfunction(seed + 1);
+	}
+	
+	user *records = (user*)calloc(n > 0 ? n : 1, sizeof(user));
+	for(long i = 0; i < n; i++) {
+		records[slotOf[i]] = users[i];
+	}
+	
+	indexHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = INDEX_MAGIC;
+	h.version = INDEX_VERSION;
+	h.count = n;
+	h.buckets = nb;
+	h.seed = seed;
+	h.sourceSize = sourceSize;
+	h.sourceMtime = sourceMtime;
+	h.dispOffset = sizeof(indexHeader);
+	h.recordOffset = (h.dispOffset + nb * sizeof(unsigned int) + 63) & ~63LL;
+	
+	char tmpName[300];
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", indexName);
+	
+	FILE *fp = fopen(tmpName, "wb");
+	int ok = (fp != NULL);
+	
+	if(ok) {
+		char pad[64] = {0};
+		ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+		if(ok) ok = fwrite(disp, sizeof(unsigned int), nb, fp) == (size_t)nb;
+		if(ok) ok = fwrite(pad, 1, h.recordOffset - h.dispOffset - nb * sizeof(unsigned int), fp) == (size_t)(h.recordOffset - h.dispOffset - nb * sizeof(unsigned int));
+		if(ok && n > 0) ok = fwrite(records, sizeof(user), n, fp) == (size_t)n;
+		ok = (fclose(fp) == 0) && ok;
+	}
+	
+	if(ok) ok = rename(tmpName, indexName) == 0;
+	if(!ok) remove(tmpName);
+	
+	free(disp);
+	free(slotOf);
+	free(cards);
+	free(records);
+	
+	return ok ? 0 : -1;
+}
 
-    while (fast != NULL && fast->next != NULL) {
-        prev = slow;
-        slow = slow->next;
-        fast = fast->next->next;
-    }
+/* Offline build step : reads users.csv (same format and parser as readUsersData) and writes the index.
+* Returns the number of users indexed, or -1 on failure.
+*/
+long buildUserIndex(const char *usersName, const char *indexName) {
+	
+	struct stat st;
+	FILE *fp = fopen(usersName, "r");
+	
+	if(fp == NULL || fstat(fileno(fp), &st) < 0) {
+		if(fp != NULL) fclose(fp);
+		return -1;
+	}
+	
+	long n = 0, cap = 1024;
+	user *users = (user*)malloc(sizeof(user) * cap);
+	char *line = getLine(&fp);	// header
+	free(line);
+	
+	while(1) {
+		
+		line = getLine(&fp);
+		
+		if(strcmp(line, "") == 0) {
+			break;
+		}
+		
+		user client = {0};
+		
+		if(parseUser(line, &client) == 1) {
+			if(n == cap) {
+				cap *= 2;
+				users = (user*)realloc(users, sizeof(user) * cap);
+			}
+			users[n++] = client;
+		}
+		
+		free(line);
+	}
+	
+	free(line);
+	fclose(fp);
+	
+	// a card that appears twice keeps its first row, as readUsersData does
+	unsigned char *repeat = (unsigned char*)malloc(n > 0 ? n : 1);
+	long kept = 0;
+	
+	repeatedCards(users, n, repeat);
+	for(long i = 0; i < n; i++) {
+		if(!repeat[i]) users[kept++] = users[i];
+	}
+	
+	free(repeat);
+	n = kept;
+	
+	int status = writeUserIndex(users, n, indexName, st.st_size, st.st_mtime);
+	free(users);
+	
+	return status == 0 ? n : -1;
+}
 
-    // Disconnect left half
-    if (prev != NULL) {
-        prev->next = NULL;
-    }
+/* Maps an index file. If usersName is given, the index is only used while it still matches that file's size and mtime.
+* Returns NULL if the index is missing, stale or malformed.
+*/
+userIndex *openUserIndex(const char *indexName, const char *usersName) {
+	
+	struct stat st, src;
+	
+	int fd = open(indexName, O_RDONLY);
+	if(fd < 0) return NULL;
+	
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(indexHeader)) {
+		close(fd);
+		return NULL;
+	}
+	
+	const char *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED) return NULL;
+	
+	const indexHeader *h = (const indexHeader*)base;
+	
+	// the counts are bounded by the file size first, so none of the products below can overflow
+	int valid = h->count >= 0 && h->count <= st.st_size / (long long)sizeof(user) && h->buckets >= 1 && h->buckets <= st.st_size / (long long)sizeof(unsigned int);
+	valid = valid && h->magic == INDEX_MAGIC && h->version == INDEX_VERSION && h->dispOffset == (long long)sizeof(indexHeader) && 
+		h->dispOffset + h->buckets * (long long)sizeof(unsigned int) <= h->recordOffset && h->recordOffset + h->count * (long long)sizeof(user) == st.st_size;
+	
+	if(valid && usersName != NULL) {
+		valid = stat(usersName, &src) == 0 && src.st_size == h->sourceSize && src.st_mtime == h->sourceMtime;
+	}
+	
+	if(!valid) {
+		munmap((void*)base, st.st_size);
+		return NULL;
+	}
+	
+	userIndex *ix = (userIndex*)malloc(sizeof(userIndex));
+	ix->base = base;
+	ix->size = st.st_size;
+	ix->header = h;
+	ix->disp = (const unsigned int*)(base + h->dispOffset);
+	ix->records = (const user*)(base + h->recordOffset);
+	
+	return ix;
+}
 
-    return slow; // Middle node
+void closeUserIndex(userIndex *ix) {
+	
+	munmap((void*)ix->base, ix->size);
+	free(ix);
 }
 
-/* Time Complexity: O(NlogN), where N is the total number of nodes.
+/* Time complexity : O(1), exactly one record is compared.
 */
+const user *indexFind(userIndex *ix, long int no) {
+	
+	long n = ix->header->count;
+	if(n == 0) return NULL;
+	
+	unsigned long long h = indexKeyHash(no, ix->header->seed);
+	unsigned int d = ix->disp[(h >> 32) % ix->header->buckets];
+	long slot = (d & INDEX_DIRECT) ? (long)(d & ~INDEX_DIRECT) : (long)(indexSlotHash(h, d) % n);
+	
+	if(slot >= n) return NULL;	// a direct slot out of range, the file is damaged
+	
+	const user *u = &ix->records[slot];
+	
+	return (u->cardNo == no) ? u : NULL;
+}
 
-transaction *sortedToBST(node *head) {
+/* Same result codes as checkUser : 1 password matched, 0 wrong password, -1 user not found.
+*/
+int indexCheckUser(userIndex *ix, long int no, char *pass) {
 	
-	if(head == NULL) return NULL;
+	const user *u = indexFind(ix, no);
 	
-	node *new = findMiddle(head);
-    	transaction* root = (transaction*)malloc(sizeof(transaction));
-    	root->date_of_payment = new->date_of_payment;
-    	root->time_of_payment = new->time_of_payment;
-    	root->payment_place = new->payment_place;
-    	root->amount = new->amount;
-    	root->status = new->status;
-    	
-    	if(head == new) {
-		root->left = NULL;
-		root->right = NULL;
-        
-    	}
-    	
-    	else {
-        
-		root->left = sortedToBST(head); // Left half
-		root->right = sortedToBST(new->next); // Right half
-    	}
-    	
-    	return root;
+	if(u == NULL) {
+		return -1;
+	}
+	
+	char *new = checkPass(pass);
+	int result = strcmp(new, u->password) == 0;
+	free(new);
+	
+	return result;
 }
 
+/* Benchmark of the perfect hash index against the dynamic Map (./credit --bench-index [n]) :
+* n synthetic users are indexed into a temporary file, which is then opened, and every card looked up.
+* Reports build time, startup (open) time, lookup cost and memory per card of both structures.
+*/
+void benchmarkUserIndex(long n) {
+	
+	const char *name = "bench_users.idx";
+	user *users = (user*)calloc(n, sizeof(user));
+	unsigned long long x = 88172645463325252ULL;
+	
+	for(long i = 0; i < n; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		users[i].cardNo = 4000000000000000L + (long)(x % 1000000000000000ULL);
+		snprintf(users[i].name, sizeof(users[i].name), "user%d", (int)(i % 100000000));
+	}
+	
+	double start = nowSeconds();
+	writeUserIndex(users, n, name, 0, 0);
+	double buildTime = nowSeconds() - start;
+	
+	start = nowSeconds();
+	userIndex *ix = openUserIndex(name, NULL);
+	double openTime = nowSeconds() - start;
+	
+	if(ix == NULL) {
+		printf(RED "Could not open %s\n" RESET, name);
+		free(users);
+		return;
+	}
+	
+	long found = 0;
+	start = nowSeconds();
+	for(long i = 0; i < n; i++) {
+		found += indexFind(ix, users[i].cardNo) != NULL;
+	}
+	double lookupTime = nowSeconds() - start;
+	
+	start = nowSeconds();
+	Map *m = initHashMap();
+	for(long i = 0; i < n; i++) {
+		enter_users(m, users[i]);
+	}
+	double mapTime = nowSeconds() - start;
+	
+	start = nowSeconds();
+	for(long i = 0; i < n; i++) {
+		found += find(m, users[i].cardNo) != NULL;
+	}
+	double mapLookupTime = nowSeconds() - start;
+	
+	double indexBytes = (double)(ix->size - ix->header->count * sizeof(user)) / n;
+	double mapBytes = (double)m->size * sizeof(mapSlot) / n;
+	
+	printf("%ld users, %.1f MB index file\n", n, ix->size / (1024.0 * 1024.0));
+	printf("perfect hash : build %8.3f s, startup (mmap) %8.3f ms, lookup %6.1f ns, %5.2f bytes/card + %zu byte record\n", buildTime, openTime * 1000, lookupTime * 1e9 / n, indexBytes, sizeof(user));
+	printf("Map          : startup (inserts) %8.3f ms, lookup %6.1f ns, %5.2f bytes/card + %zu byte item\n", mapTime * 1000, mapLookupTime * 1e9 / n, mapBytes, sizeof(item));
+	printf("%ld lookups found\n", found);
+	
+	for(int i = 0; i < m->size; i++) {
+		if(m->slots[i].dist != 0) free(m->slots[i].value);
+	}
+	free(m->slots);
+	free(m);
+	closeUserIndex(ix);
+	remove(name);
+	free(users);
+}
 
+void init_dll(dll *list) {
+	list->head = NULL;
+	list->end = NULL;
+	list->pool = NULL;
+}
 
-float calculateMean(dll *list) {
-    node *temp = list->head;
-    float mean = 0.00;
-    int count = 0;
+node* createNode(char *id, date payment_date, struct tm payment_time, locId payment_place, int zip_code, float amount, char status) {
     
-    // Traverse the linked list and sum the amounts
-    while (temp != NULL) {
+    node* newNode = (node*)malloc(sizeof(node));
+    strcpy(newNode->transaction_id, id);
+    newNode->date_of_payment = payment_date;
+    newNode->time_of_payment = payment_time;
+    newNode->payment_place = payment_place;
+    newNode->zipCode = zip_code;
+    newNode->amount = amount;
+    newNode->status = status;
+    newNode->prev = NULL;
+    newNode->next = NULL;
+    newNode->epoch = toEpoch(payment_date, payment_time);
     
-    	if (temp->status == 'S' || temp->status == 's') {
-		mean = mean + temp->amount;  // Accumulate the amount
-		count++;  // Increment the count
+    return newNode;
+}
+
+void insertEnd(dll* list, node* newNode) {
+    if (list->head == NULL) {
+        list->head = newNode;
+        list->end = newNode;
+    } 
+    
+    else {
+        list->end->next = newNode;
+        newNode->prev = list->end;
+        list->end = newNode;
+    }
+}
+
+void readCsv(dll *list, FILE **fp) {
+
+	char *line;
+	
+	// to skip the first line;
+	line = getLine(fp);
+	
+	while(1) {
+	
+		line = getLine(fp);
+		
+		if(strcmp(line, "") == 0 || line == NULL) {
+			break;
+		}
+		
+		char *token = strtok(line, ",");
+		char id[20];
+		strncpy(id, token, sizeof(id) - 1);
+		id[sizeof(id) - 1] = '\0'; // Ensure null-termination
+		
+		// Date
+		token = strtok(NULL, ",");
+		date payment_date;
+		sscanf(token, "%d-%d-%d", &payment_date.day, &payment_date.month, &payment_date.year);
+		
+		// Time
+		token = strtok(NULL, ",");
+		struct tm payment_time;
+		sscanf(token, "%d:%d:%d", &payment_time.tm_hour, &payment_time.tm_min, &payment_time.tm_sec);
+		
+		// City
+		token = strtok(NULL, ",");
+		locId payment_place;
+		payment_place.city = internLocation(token, token + strlen(token));
+		
+		
+		 // State
+		token = strtok(NULL, ",");
+		payment_place.state = internLocation(token, token + strlen(token));
+		
+		//country 
+		token = strtok(NULL, ",");
+		payment_place.country = internLocation(token, token + strlen(token));
+		
+		token = strtok(NULL, ",");
+        	int zip_code = atoi(token);
+		
+		// Amount
+		token = strtok(NULL, ",");
+		float amount = atof(token);
+		
+		//status 
+		token = strtok(NULL, ",");
+        	char status = token[0];
+        	
+        	node* newNode = createNode(id, payment_date, payment_time, payment_place, zip_code, amount, status);
+        	insertEnd(list, newNode);
+        	
+        	free(line);
+	}
+	
+	free(line);
+}
+
+/* Monotonic wall clock in seconds, used to time the loaders and benchmarks.
+*/
+double nowSeconds() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Parses the unsigned decimal digits in [p, e), stopping at the first non digit.
+*/
+static int parseDigits(const char *p, const char *e) {
+	
+	int value = 0;
+	
+	while(p < e && *p >= '0' && *p <= '9') {
+		value = value * 10 + (*p - '0');
+		p++;
+	}
+	
+	return value;
+}
+
+/* Parses "a<sep>b<sep>c" in [p, e) into three integers, e.g. 01-10-2024 or 08:32:15.
+*/
+static void parseTriple(const char *p, const char *e, char sep, int *a, int *b, int *c) {
+	
+	const char *q = memchr(p, sep, e - p);
+	const char *r = (q == NULL) ? NULL : memchr(q + 1, sep, e - q - 1);
+	
+	*a = parseDigits(p, e);
+	*b = (q == NULL) ? 0 : parseDigits(q + 1, e);
+	*c = (r == NULL) ? 0 : parseDigits(r + 1, e);
+}
+
+/* Parses an amount such as 2545 or 8693.965 without going through atof.
+*/
+static float parseAmount(const char *p, const char *e) {
+	
+	double value = 0.0;
+	double scale = 1.0;
+	int negative = 0;
+	
+	if(p < e && *p == '-') {
+		negative = 1;
+		p++;
+	}
+	
+	while(p < e && *p >= '0' && *p <= '9') {
+		value = value * 10 + (*p - '0');
+		p++;
+	}
+	
+	if(p < e && *p == '.') {
+		p++;
+		while(p < e && *p >= '0' && *p <= '9') {
+			value = value * 10 + (*p - '0');
+			scale *= 10;
+			p++;
+		}
+	}
+	
+	value /= scale;
+	return (float)(negative ? -value : value);
+}
+
+/* Copies the field [p, e) into a fixed size buffer, truncating and null terminating it.
+*/
+static void copyField(char *dest, int size, const char *p, const char *e) {
+	
+	int len = e - p;
+	
+	if(len > size - 1) len = size - 1;
+	
+	memcpy(dest, p, len);
+	dest[len] = '\0';
+}
+
+/* Two ascii digits to their value, -1 if either is not a digit.
+*/
+static int twoDigits(const char *p) {
+	
+	unsigned int a = (unsigned char)p[0] - '0';
+	unsigned int b = (unsigned char)p[1] - '0';
+	
+	if(a > 9 || b > 9) return -1;
+	
+	return a * 10 + b;
+}
+
+/* Date field. The fixed shape dd-mm-yyyy is decoded directly from its ten bytes, 
+* anything else (e.g. 2-10-2017) goes through the generic parseTriple.
+*/
+static void parseDate(const char *p, const char *e, date *d) {
+	
+	if(e - p == 10 && p[2] == '-' && p[5] == '-') {
+		
+		int day = twoDigits(p);
+		int month = twoDigits(p + 3);
+		int hi = twoDigits(p + 6);
+		int lo = twoDigits(p + 8);
+		
+		if(day >= 0 && month >= 0 && hi >= 0 && lo >= 0) {
+			d->day = day;
+			d->month = month;
+			d->year = hi * 100 + lo;
+			return;
+		}
+	}
+	
+	parseTriple(p, e, '-', &d->day, &d->month, &d->year);
+}
+
+/* Time field, fixed shape hh:mm:ss with the same generic fallback as parseDate.
+*/
+static void parseTime(const char *p, const char *e, struct tm *t) {
+	
+	if(e - p == 8 && p[2] == ':' && p[5] == ':') {
+		
+		int hour = twoDigits(p);
+		int min = twoDigits(p + 3);
+		int sec = twoDigits(p + 6);
+		
+		if(hour >= 0 && min >= 0 && sec >= 0) {
+			t->tm_hour = hour;
+			t->tm_min = min;
+			t->tm_sec = sec;
+			return;
+		}
+	}
+	
+	parseTriple(p, e, ':', &t->tm_hour, &t->tm_min, &t->tm_sec);
+}
+
+/* Row splitters : starting at p, they record the positions of the first 9 commas of the row in commas[] 
+* and return the position of the newline ending the row (end if there is none).
+* The SSE2 and AVX2 versions compare 16 / 32 bytes at a time against ',' and '\n' and walk the resulting bit masks,
+* the scalar version is the portable fallback and also handles the tail of the buffer for the vector ones.
+*/
+static const char *splitTail(const char *q, const char *end, const char **commas, int k, int *n) {
+	
+	while(q < end && *q != '\n') {
+		if(*q == ',' && k < 9) commas[k++] = q;
+		q++;
+	}
+	
+	*n = k;
+	return q;
+}
+
+static const char *splitRowScalar(const char *p, const char *end, const char **commas, int *n) {
+	return splitTail(p, end, commas, 0, n);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+static const char *splitRowSSE2(const char *p, const char *end, const char **commas, int *n) {
+	
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i newline = _mm_set1_epi8('\n');
+	const char *q = p;
+	int k = 0;
+	
+	while(q + 16 <= end) {
+		
+		__m128i v = _mm_loadu_si128((const __m128i*)q);
+		unsigned int mc = _mm_movemask_epi8(_mm_cmpeq_epi8(v, comma));
+		unsigned int mn = _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+		
+		if(mn != 0) mc &= (mn & -mn) - 1;	// only the commas before the newline
+		
+		while(mc != 0) {
+			if(k < 9) commas[k++] = q + __builtin_ctz(mc);
+			mc &= mc - 1;
+		}
+		
+		if(mn != 0) {
+			*n = k;
+			return q + __builtin_ctz(mn);
+		}
+		
+		q += 16;
+	}
+	
+	return splitTail(q, end, commas, k, n);
+}
+
+__attribute__((target("avx2")))
+static const char *splitRowAVX2(const char *p, const char *end, const char **commas, int *n) {
+	
+	const __m256i comma = _mm256_set1_epi8(',');
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const char *q = p;
+	int k = 0;
+	
+	while(q + 32 <= end) {
+		
+		__m256i v = _mm256_loadu_si256((const __m256i*)q);
+		unsigned int mc = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, comma));
+		unsigned int mn = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+		
+		if(mn != 0) mc &= (mn & -mn) - 1;
+		
+		while(mc != 0) {
+			if(k < 9) commas[k++] = q + __builtin_ctz(mc);
+			mc &= mc - 1;
+		}
+		
+		if(mn != 0) {
+			*n = k;
+			return q + __builtin_ctz(mn);
+		}
+		
+		q += 32;
+	}
+	
+	return splitTail(q, end, commas, k, n);
+}
+
+#endif
+
+static int splitterLevel = SPLIT_BEST;
+
+/* Forces the row splitter used by the loaders (SPLIT_SCALAR, SPLIT_SSE2, SPLIT_AVX2 or SPLIT_BEST).
+* Returns the level that will actually be used on this cpu.
+*/
+int setRowSplitter(int level) {
+	
+	__atomic_store_n(&splitterLevel, level, __ATOMIC_RELAXED);
+	
+#if defined(__x86_64__) || defined(__i386__)
+	if(level == SPLIT_BEST || level == SPLIT_AVX2) {
+		if(__builtin_cpu_supports("avx2")) return SPLIT_AVX2;
+		level = SPLIT_SSE2;
+	}
+	
+	if(level == SPLIT_SSE2 && __builtin_cpu_supports("sse2")) return SPLIT_SSE2;
+#endif
+
+	return SPLIT_SCALAR;
+}
+
+static rowSplitter currentSplitter() {
+	
+#if defined(__x86_64__) || defined(__i386__)
+	int level = __atomic_load_n(&splitterLevel, __ATOMIC_RELAXED);
+	
+	if((level == SPLIT_BEST || level == SPLIT_AVX2) && __builtin_cpu_supports("avx2")) return splitRowAVX2;
+	if(level != SPLIT_SCALAR && __builtin_cpu_supports("sse2")) return splitRowSSE2;
+#endif
+
+	return splitRowScalar;
+}
+
+typedef struct locCache {
+	char name[3][DICT_NAME];
+	int len[3];
+	int id[3];
+}locCache;
+
+/* Interns one location field through a one entry cache : consecutive rows of a history mostly share their place, 
+* so most rows are resolved with a short memcmp and never touch the (locked) global table.
+*/
+static int cachedLocation(locCache *cache, int k, const char *s, const char *e) {
+	
+	int len = e - s;
+	if(len > DICT_NAME - 1) len = DICT_NAME - 1;
+	
+	if(cache == NULL) return internLocation(s, s + len);
+	
+	if(cache->id[k] >= 0 && cache->len[k] == len && memcmp(cache->name[k], s, len) == 0) return cache->id[k];
+	
+	memcpy(cache->name[k], s, len);
+	cache->len[k] = len;
+	cache->id[k] = internLocation(s, s + len);
+	
+	return cache->id[k];
+}
+
+/* Fills an already allocated node from a row whose comma positions are known.
+* Returns 1 if the row had all nine fields, 0 otherwise.
+* Time Complexity : O(C), where C is the length of the row.
+*/
+static int parseFields(const char *p, const char *e, const char **commas, int n, node *out, locCache *cache) {
+	
+	if(n < 8) return 0;
+	
+	if(e > p && e[-1] == '\r') e--;
+	
+	const char *field[9];
+	const char *fieldEnd[9];
+	
+	field[0] = p;
+	for(int i = 0; i < 8; i++) {
+		fieldEnd[i] = commas[i];
+		field[i + 1] = commas[i] + 1;
+	}
+	fieldEnd[8] = (n > 8) ? commas[8] : e;
+	
+	memset(&out->time_of_payment, 0, sizeof(out->time_of_payment));
+	
+	copyField(out->transaction_id, sizeof(out->transaction_id), field[0], fieldEnd[0]);
+	parseDate(field[1], fieldEnd[1], &out->date_of_payment);
+	parseTime(field[2], fieldEnd[2], &out->time_of_payment);
+	out->payment_place.city = cachedLocation(cache, 0, field[3], fieldEnd[3]);
+	out->payment_place.state = cachedLocation(cache, 1, field[4], fieldEnd[4]);
+	out->payment_place.country = cachedLocation(cache, 2, field[5], fieldEnd[5]);
+	out->zipCode = parseDigits(field[6], fieldEnd[6]);
+	out->amount = parseAmount(field[7], fieldEnd[7]);
+	out->status = (field[8] < fieldEnd[8]) ? field[8][0] : '\0';
+	out->epoch = toEpoch(out->date_of_payment, out->time_of_payment);
+	out->prev = NULL;
+	out->next = NULL;
+	
+	return 1;
+}
+
+/* Parses one transaction row [p, e) (without the newline) directly into an already allocated node.
+* Nothing is copied or allocated for the line itself.
+* Returns 1 if the row had all nine fields, 0 otherwise.
+*/
+int parseRow(const char *p, const char *e, node *out) {
+	
+	const char *commas[9];
+	int n;
+	
+	splitRowScalar(p, e, commas, &n);
+	
+	return parseFields(p, e, commas, n, out, NULL);
+}
+
+/* Parses every row from p up to end into list, using the current row splitter.
+* With complete set, a last row that is not terminated by a newline is left alone.
+* Returns the position just after the last row consumed.
+*/
+static const char *parseRows(dll *list, const char *p, const char *end, int complete, long *rows) {
+	
+	rowSplitter split = currentSplitter();
+	node *spare = NULL;	// node of a malformed row, reused for the next one
+	locCache cache = {.id = {-1, -1, -1}};
+	
+	while(p < end) {
+		
+		const char *commas[9];
+		int n;
+		const char *lineEnd = split(p, end, commas, &n);
+		
+		if(complete && lineEnd == end) break;	// incomplete row
+		
+		if(lineEnd > p && !(lineEnd - p == 1 && *p == '\r')) {
+			
+			node *newNode = (spare != NULL) ? spare : (node*)arenaAlloc(list->pool, sizeof(node));
+			spare = NULL;
+			
+			if(parseFields(p, lineEnd, commas, n, newNode, &cache) == 1) {
+				insertEnd(list, newNode);
+				(*rows)++;
+			}
+			
+			else {
+				spare = newNode;
+			}
+		}
+		
+		p = (lineEnd == end) ? end : lineEnd + 1;
+	}
+	
+	if(spare != NULL && list->pool == NULL) free(spare);
+	
+	return p;
+}
+
+/* Memory mapped replacement for readCsv.
+* The whole file is mapped read-only and every row is split with the SIMD row splitter and parsed in place 
+* from the mapping, so the only allocation per row is the node itself (no line buffers, no strtok/sscanf/atof).
+* The header line is skipped, blank lines are ignored.
+* Fills stats (if not NULL) with the bytes and rows consumed and the time taken, see throughputMBps.
+* Returns 0 on success and -1 if the file could not be opened or mapped.
+* Time Complexity : O(B), where B is the size of the file in bytes.
+*/
+int readCsvMmap(dll *list, const char *fileName, loadStats *stats) {
+	
+	double start = nowSeconds();
+	long rows = 0;
+	
+	int fd = open(fileName, O_RDONLY);
+	if(fd < 0) {
+		return -1;
+	}
+	
+	struct stat st;
+	if(fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	
+	size_t size = st.st_size;
+	
+	if(size > 0) {
+		
+		const char *buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(buf == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		
+		madvise((void*)buf, size, MADV_SEQUENTIAL);
+		
+		const char *end = buf + size;
+		const char *p = memchr(buf, '\n', size);	// skip the header line
+		p = (p == NULL) ? end : p + 1;
+		
+		parseRows(list, p, end, 0, &rows);
+		
+		munmap((void*)buf, size);
+	}
+	
+	close(fd);
+	
+	if(stats != NULL) {
+		stats->bytes = size;
+		stats->rows = rows;
+		stats->seconds = nowSeconds() - start;
+		stats->source = 0;
+	}
+	
+	return 0;
+}
+
+/* Throughput of a load in MB/s (1 MB = 2^20 bytes).
+*/
+double throughputMBps(loadStats stats) {
+	
+	if(stats.seconds <= 0) return 0.0;
+	
+	return (stats.bytes / (1024.0 * 1024.0)) / stats.seconds;
+}
+
+/* Arena allocator for the nodes of one user's history.
+* Memory is handed out by bumping a pointer through large chunks, so an allocation is a few instructions, 
+* consecutive nodes are contiguous in memory, and the whole history (list, tree, appended rows) is released 
+* with one arenaDestroy instead of a free per node. A NULL arena falls back to malloc.
+*/
+arena *arenaCreate(size_t chunkSize) {
+	
+	arena *a = (arena*)malloc(sizeof(arena));
+	a->chunks = NULL;
+	a->chunkSize = chunkSize;
+	a->reserved = 0;
+	a->allocations = 0;
+	
+	return a;
+}
+
+void *arenaAlloc(arena *a, size_t n) {
+	
+	if(a == NULL) {
+		return malloc(n);
+	}
+	
+	n = (n + 15) & ~(size_t)15;
+	arenaChunk *c = a->chunks;
+	
+	if(c == NULL || c->used + n > c->size) {
+		
+		size_t size = (n > a->chunkSize) ? n : a->chunkSize;
+		
+		c = (arenaChunk*)malloc(sizeof(arenaChunk) + size);
+		c->size = size;
+		c->used = 0;
+		
+		if(n > a->chunkSize && a->chunks != NULL) {
+			// an oversized block gets its own chunk behind the current one, which stays open for small allocations
+			c->next = a->chunks->next;
+			a->chunks->next = c;
+		}
+		
+		else {
+			c->next = a->chunks;
+			a->chunks = c;
+		}
+		
+		a->reserved += sizeof(arenaChunk) + size;
+		
+		if(a->chunkSize < ARENA_MAX_CHUNK) a->chunkSize *= 2;	// fewer, larger chunks for large histories
+	}
+	
+	void *p = c->data + c->used;
+	c->used += n;
+	a->allocations++;
+	
+	return p;
+}
+
+/* Frees all the chunks, and with them everything ever allocated from the arena.
+* Time Complexity : O(number of chunks).
+*/
+void arenaDestroy(arena *a) {
+	
+	if(a == NULL) return;
+	
+	arenaChunk *c = a->chunks;
+	
+	while(c != NULL) {
+		arenaChunk *next = c->next;
+		free(c);
+		c = next;
+	}
+	
+	free(a);
+}
+
+typedef struct dateSlot {
+	int key;
+	int pos;
+}dateSlot;
+
+static int compareDateSlots(const void *a, const void *b) {
+	
+	const dateSlot *x = (const dateSlot*)a;
+	const dateSlot *y = (const dateSlot*)b;
+	
+	if(x->key != y->key) return (x->key < y->key) ? -1 : 1;
+	
+	return (x->pos < y->pos) ? -1 : (x->pos > y->pos);	// keep the list order for equal dates
+}
+
+static transaction *nodesToBST(arena *pool, node **nodes, long lo, long hi) {
+	
+	if(lo > hi) return NULL;
+	
+	long mid = lo + (hi - lo + 1) / 2;	// the same middle as findMiddle
+	node *new = nodes[mid];
+	
+	transaction *root = (transaction*)arenaAlloc(pool, sizeof(transaction));
+	root->date_of_payment = new->date_of_payment;
+	root->time_of_payment = new->time_of_payment;
+	root->payment_place = new->payment_place;
+	root->amount = new->amount;
+	root->status = new->status;
+	root->left = nodesToBST(pool, nodes, lo, mid - 1);
+	root->right = nodesToBST(pool, nodes, mid + 1, hi);
+	
+	return root;
+}
+
+/* Builds the same tree as copyList + sortedToBST, without copying the list : 
+* the nodes are indexed once in a temporary array and the middle of every range is found in O(1).
+* Time Complexity : O(N).
+*/
+transaction *buildDateBST(arena *pool, dll list, long count) {
+	
+	if(count <= 0) return NULL;
+	
+	node **nodes = (node**)malloc(sizeof(node*) * count);
+	long i = 0;
+	
+	for(node *temp = list.head; temp != NULL && i < count; temp = temp->next) {
+		nodes[i++] = temp;
+	}
+	
+	transaction *root = nodesToBST(pool, nodes, 0, i - 1);
+	free(nodes);
+	
+	return root;
+}
+
+/* Fills the Eytzinger layout by an in-order walk of the implicit tree : the i-th key in date order lands in the i-th 
+* slot visited in-order, so a sorted input gives a valid search tree.
+*/
+static void fillEytzinger(dateIndex *idx, const int *keys, long k, long *i) {
+	
+	if(k > idx->count) return;
+	
+	fillEytzinger(idx, keys, 2 * k, i);
+	idx->keys[k] = keys[*i];
+	idx->rank[k] = *i;
+	(*i)++;
+	fillEytzinger(idx, keys, 2 * k + 1, i);
+}
+
+/* Builds the date index from keys (sorted ascending) and order, order[r] being the position of the transaction with key keys[r].
+* idx takes over order.
+* Time Complexity : O(N), each slot is written once.
+*/
+void buildDateIndex(dateIndex *idx, const int *keys, int *order, long count) {
+	
+	idx->count = count;
+	idx->order = order;
+	idx->keys = (int*)malloc(sizeof(int) * (count + 1));
+	idx->rank = (int*)malloc(sizeof(int) * (count + 1));
+	idx->keys[0] = 0;
+	idx->rank[0] = count;
+	
+	long i = 0;
+	fillEytzinger(idx, keys, 1, &i);
+}
+
+/* Builds the date index of a list. The csv histories are written in date order, which is checked in one pass; 
+* a list that is not sorted is ordered by (date, position) first, so equal dates keep the order of the list.
+* Time Complexity : O(N) for a sorted list, O(NlogN) otherwise.
+*/
+void indexListDates(dateIndex *idx, dll list, long count) {
+	
+	int *keys = (int*)malloc(sizeof(int) * (count > 0 ? count : 1));
+	int *order = (int*)malloc(sizeof(int) * (count > 0 ? count : 1));
+	int sorted = 1;
+	long n = 0;
+	
+	for(node *temp = list.head; temp != NULL && n < count; temp = temp->next, n++) {
+		keys[n] = dateKey(temp->date_of_payment);
+		order[n] = n;
+		if(n > 0 && keys[n] < keys[n - 1]) sorted = 0;
+	}
+	
+	if(!sorted) {
+		
+		dateSlot *slots = (dateSlot*)malloc(sizeof(dateSlot) * n);
+		
+		for(long i = 0; i < n; i++) {
+			slots[i].key = keys[i];
+			slots[i].pos = i;
+		}
+		
+		qsort(slots, n, sizeof(dateSlot), compareDateSlots);
+		
+		for(long i = 0; i < n; i++) {
+			keys[i] = slots[i].key;
+			order[i] = slots[i].pos;
+		}
+		
+		free(slots);
+	}
+	
+	buildDateIndex(idx, keys, order, n);
+	free(keys);
+}
+
+/* Rank (position in date order) of the first transaction dated key or later, count if there is none.
+* Branchless descent of the Eytzinger tree : the comparison picks the child, the last left turn is recovered 
+* from the trailing ones of k. The next levels are prefetched, the top of the tree stays in cache.
+* Time Complexity : O(logN).
+*/
+long dateIndexLowerBound(const dateIndex *idx, int key) {
+	
+	long k = 1;
+	
+	while(k <= idx->count) {
+		__builtin_prefetch(idx->keys + 16 * k);
+		k = 2 * k + (idx->keys[k] < key);
+	}
+	
+	k >>= __builtin_ffsl(~k);
+	
+	return idx->rank[k];	// rank[0] is count
+}
+
+void freeDateIndex(dateIndex *idx) {
+	
+	free(idx->keys);
+	free(idx->rank);
+	free(idx->order);
+	memset(idx, 0, sizeof(*idx));
+}
+
+long dateIndexBytes(const dateIndex *idx) {
+	return (idx->count > 0) ? (3 * idx->count + 2) * (long)sizeof(int) : 0;
+}
+
+// Number of transactions dated key in a date BST, without printing them (for the benchmark).
+
+static long countDateBST(transaction *root, int key) {
+	
+	long count = 0;
+	
+	while(root != NULL) {
+		
+		int k = dateKey(root->date_of_payment);
+		
+		if(key < k) root = root->left;
+		else if(key > k) root = root->right;
+		else return 1 + countDateBST(root->left, key) + countDateBST(root->right, key);
+	}
+	
+	return count;
+}
+
+/* Date lookup benchmark (./credit --bench-dates [n] [queries]) on a synthetic history of n transactions in date order 
+* spread over 1950 - 2049 : the pointer BST of buildDateBST against the Eytzinger index, 
+* build time, bytes per transaction, and the number of transactions on random dates.
+*/
+void benchmarkDateIndex(long count, long queries) {
+	
+	if(count < 1) count = 1;
+	
+	int *keys = (int*)malloc(sizeof(int) * count);
+	int *order = (int*)malloc(sizeof(int) * count);
+	node **nodes = (node**)malloc(sizeof(node*) * count);
+	node *block = (node*)calloc(count, sizeof(node));
+	int *targets = (int*)malloc(sizeof(int) * queries);
+	long days = 100L * 360;
+	unsigned long long seed = 88172645463325252ULL;
+	
+	if(keys == NULL || order == NULL || nodes == NULL || block == NULL || targets == NULL) {
+		printf(RED "Not enough memory for %ld transactions\n" RESET, count);
+		free(keys); free(order); free(nodes); free(block); free(targets);
+		return;
+	}
+	
+	for(long i = 0; i < count; i++) {
+		long day = i * days / count;	// sorted, about count / days transactions per date
+		block[i].date_of_payment.year = 1950 + day / 360;
+		block[i].date_of_payment.month = 1 + (day % 360) / 30;
+		block[i].date_of_payment.day = 1 + day % 30;
+		keys[i] = dateKey(block[i].date_of_payment);
+		order[i] = i;
+		nodes[i] = &block[i];
+	}
+	
+	for(long q = 0; q < queries; q++) {
+		seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+		targets[q] = keys[seed % count] + (int)((seed >> 40) & 1);	// half existing dates, half mostly missing
+	}
+	
+	double start = nowSeconds();
+	arena *pool = arenaCreate(ARENA_CHUNK);
+	transaction *root = nodesToBST(pool, nodes, 0, count - 1);
+	double bstBuild = nowSeconds() - start;
+	long bstBytes = pool->reserved;
+	
+	start = nowSeconds();
+	long bstFound = 0;
+	for(long q = 0; q < queries; q++) {
+		bstFound += countDateBST(root, targets[q]);
+	}
+	double bstQuery = nowSeconds() - start;
+	arenaDestroy(pool);
+	
+	start = nowSeconds();
+	dateIndex idx;
+	buildDateIndex(&idx, keys, order, count);
+	double eytBuild = nowSeconds() - start;
+	
+	start = nowSeconds();
+	long eytFound = 0;
+	for(long q = 0; q < queries; q++) {
+		eytFound += dateIndexLowerBound(&idx, targets[q] + 1) - dateIndexLowerBound(&idx, targets[q]);
+	}
+	double eytQuery = nowSeconds() - start;
+	
+	printf("%ld transactions, %ld lookups\n", count, queries);
+	printf("BST       : build %9.3f ms, %6.1f bytes/tx, lookups %8.1f ns each, %ld found\n", bstBuild * 1000, (double)bstBytes / count, bstQuery * 1e9 / queries, bstFound);
+	printf("Eytzinger : build %9.3f ms, %6.1f bytes/tx, lookups %8.1f ns each, %ld found\n", eytBuild * 1000, (double)dateIndexBytes(&idx) / count, eytQuery * 1e9 / queries, eytFound);
+	
+	freeDateIndex(&idx);
+	free(keys);
+	free(nodes);
+	free(block);
+	free(targets);
+}
+
+static long heapInUse() {
+	
+	struct mallinfo2 mi = mallinfo2();
+	return (long)(mi.uordblks + mi.hblkhd);
+}
+
+static long residentBytes() {
+	
+	long pages = 0, resident = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	
+	if(fp != NULL) {
+		if(fscanf(fp, "%ld %ld", &pages, &resident) != 2) resident = 0;
+		fclose(fp);
+	}
+	
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+/* Load / teardown benchmark of one history (./credit --bench-arena <file.csv>), malloc against the arena :
+* before : readCsvMmap with a malloc per node, copyList + sortedToBST + free(head) as the login used to do, 
+*          then logout with freeList + freeTree.
+* after  : the arena backed list and buildDateBST, then logout with arenaDestroy.
+* Reports load and teardown time, the resident memory added by the load, and the heap bytes still allocated after logout (leaks).
+*/
+void benchmarkArena(const char *csvName) {
+	
+	for(int useArena = 1; useArena >= 0; useArena--) {	// arena first, so the leaked malloc nodes do not distort its figures
+		
+		long heapBefore = heapInUse();
+		long rssBefore = residentBytes();
+		double start = nowSeconds();
+		
+		dll list;
+		init_dll(&list);
+		arena *pool = NULL;
+		transaction *root;
+		long rows = 0;
+		
+		if(useArena) {
+			pool = arenaCreate(ARENA_CHUNK);
+			list.pool = pool;
+		}
+		
+		if(readCsvMmap(&list, csvName, NULL) == -1) {
+			printf(RED "Could not open %s\n" RESET, csvName);
+			arenaDestroy(pool);
+			return;
+		}
+		
+		for(node *temp = list.head; temp != NULL; temp = temp->next) rows++;
+		
+		if(useArena) {
+			root = buildDateBST(pool, list, rows);
+		}
+		
+		else {
+			node *head = copyList(list);
+			root = sortedToBST(head);
+			free(head);
+		}
+		
+		double loadTime = nowSeconds() - start;
+		long rss = residentBytes() - rssBefore;
+		
+		start = nowSeconds();
+		
+		if(useArena) {
+			arenaDestroy(pool);
+		}
+		
+		else {
+			freeList(&list);
+			freeTree(root);
+		}
+		
+		double freeTime = nowSeconds() - start;
+		long leaked = heapInUse() - heapBefore;
+		
+		printf("%-6s : %ld rows, load %9.3f ms, teardown %8.3f ms, +%.1f MB resident, %ld bytes leaked (~%ld nodes)\n", useArena ? "arena" : "malloc", rows, loadTime * 1000, freeTime * 1000, rss / (1024.0 * 1024.0), leaked, leaked / (long)sizeof(node));
+	}
+}
+
+/* Frees every node of a malloc backed list and leaves it empty. 
+* The nodes of a list with a pool belong to the arena and are released with arenaDestroy.
+*/
+void freeList(dll *list) {
+	
+	node *temp = (list->pool == NULL) ? list->head : NULL;
+	
+	while(temp != NULL) {
+		node *next = temp->next;
+		free(temp);
+		temp = next;
+	}
+	
+	init_dll(list);
+}
+
+/* Microbenchmark of the csv parsers on one file (./credit --bench-parse <file.csv> [rounds]) :
+* the original readCsv (getLine + strtok + sscanf + atof) against readCsvMmap with the scalar, SSE2 and AVX2 row splitters.
+* Every parser runs rounds times and the best time is reported.
+*/
+void benchmarkParsers(const char *csvName, int rounds) {
+	
+	const char *names[] = {"readCsv (getLine/strtok)", "readCsvMmap scalar", "readCsvMmap SSE2", "readCsvMmap AVX2"};
+	int levels[] = {0, SPLIT_SCALAR, SPLIT_SSE2, SPLIT_AVX2};
+	struct stat st;
+	
+	if(stat(csvName, &st) < 0) {
+		printf(RED "Could not open %s\n" RESET, csvName);
+		return;
+	}
+	
+	if(rounds < 1) rounds = 1;
+	
+	for(int m = 0; m < 4; m++) {
+		
+		if(m > 0 && setRowSplitter(levels[m]) != levels[m]) {
+			printf("%-26s not supported on this cpu\n", names[m]);
+			continue;
+		}
+		
+		double best = 0;
+		long rows = 0;
+		
+		for(int r = 0; r < rounds; r++) {
+			
+			dll list;
+			init_dll(&list);
+			double start = nowSeconds();
+			
+			if(m == 0) {
+				FILE *fp = fopen(csvName, "r");
+				readCsv(&list, &fp);
+				fclose(fp);
+			}
+			
+			else {
+				readCsvMmap(&list, csvName, NULL);
+			}
+			
+			double t = nowSeconds() - start;
+			if(r == 0 || t < best) best = t;
+			
+			rows = 0;
+			for(node *temp = list.head; temp != NULL; temp = temp->next) rows++;
+			freeList(&list);
+		}
+		
+		loadStats stats = {st.st_size, rows, best, 0};
+		printf("%-26s %9ld rows %9.3f ms %9.2f MB/s\n", names[m], rows, best * 1000, throughputMBps(stats));
+	}
+	
+	setRowSplitter(SPLIT_BEST);
+}
+
+// Compares two transaction lists field by field, idLength characters of the ids; prints the first difference.
+
+static int sameHistory(const char *what, dll a, dll b, size_t idLength) {
+	
+	node *x = a.head, *y = b.head;
+	long row = 0;
+	
+	for(; x != NULL && y != NULL; x = x->next, y = y->next, row++) {
+		
+		if(strncmp(x->transaction_id, y->transaction_id, idLength) != 0 || compareDate(x->date_of_payment, y->date_of_payment) != 0 || 
+		   x->time_of_payment.tm_hour != y->time_of_payment.tm_hour || x->time_of_payment.tm_min != y->time_of_payment.tm_min || 
+		   x->time_of_payment.tm_sec != y->time_of_payment.tm_sec || x->payment_place.city != y->payment_place.city || 
+		   x->payment_place.state != y->payment_place.state || x->payment_place.country != y->payment_place.country || 
+		   x->zipCode != y->zipCode || x->amount != y->amount || x->status != y->status || x->epoch != y->epoch) {
+			printf(RED "%s : row %ld differs (%s)\n" RESET, what, row, x->transaction_id);
+			return 0;
+		}
+	}
+	
+	if(x != NULL || y != NULL) {
+		printf(RED "%s : row counts differ after %ld rows\n" RESET, what, row);
+		return 0;
+	}
+	
+	return 1;
+}
+
+/* History of a scratch user "selftest" built from csvName in two steps : the first half of the rows through 
+* loadUserHistory, the rest through appendCsvRows, so the checks see both the loaded and the appended structures.
+* The scratch csv and snapshot are removed again. Returns NULL if csvName cannot be read.
+*/
+static item *selfTestHistory(const user *owner, const char *csvName) {
+	
+	struct stat st;
+	int fd = open(csvName, O_RDONLY);
+	if(fd < 0) return NULL;
+	
+	if(fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	
+	char *buf = (char*)malloc(st.st_size);
+	ssize_t got = read(fd, buf, st.st_size);
+	close(fd);
+	
+	if(got != st.st_size) {
+		free(buf);
+		return NULL;
+	}
+	
+	long lines = 0;
+	for(long k = 0; k < st.st_size; k++) lines += (buf[k] == '\n');
+	
+	long half = 0, seen = 0;	// end of the header and the first half of the rows
+	for(long k = 0; k < st.st_size && half == 0; k++) {
+		if(buf[k] == '\n' && ++seen == 1 + (lines - 1) / 2) half = k + 1;
+	}
+	if(half == 0) half = st.st_size;
+	
+	item *it = (item*)calloc(1, sizeof(item));
+	it->client = *owner;
+	strcpy(it->client.name, "selftest");
+	
+	FILE *csv = fopen("selftest.csv", "wb");
+	int ok = csv != NULL && fwrite(buf, 1, half, csv) == (size_t)half;
+	if(csv != NULL) ok = (fclose(csv) == 0) && ok;
+	
+	ok = ok && loadUserHistory(it, NULL) != -1;
+	
+	if(ok) {
+		csv = fopen("selftest.csv", "ab");
+		ok = csv != NULL && fwrite(buf + half, 1, st.st_size - half, csv) == (size_t)(st.st_size - half);
+		if(csv != NULL) ok = (fclose(csv) == 0) && ok;
+		ok = ok && appendCsvRows(it, "selftest.csv") >= 0;
+	}
+	
+	remove("selftest.csv");
+	remove("selftest.snap");
+	free(buf);
+	
+	if(!ok) {
+		freeHistory(it);
+		free(it);
+		return NULL;
+	}
+	
+	return it;
+}
+
+// Column positions of the rows dated in [from, to] by a scan, in cursor order : by date, then by position.
+
+static long scanDates(const item *it, int from, int to, dateSlot *out) {
+	
+	long found = 0;
+	
+	for(long i = 0; i < it->cols.count; i++) {
+		int key = dateKey(it->cols.row[i]->date_of_payment);
+		if(key >= from && key <= to) {
+			out[found].key = key;
+			out[found++].pos = i;
+		}
+	}
+	
+	qsort(out, found, sizeof(dateSlot), compareDateSlots);
+	return found;
+}
+
+// The date range cursor over the date index and the appended tree, against a scan, for ranges around a few rows.
+
+static int checkDateRanges(item *it) {
+	
+	long n = it->cols.count;
+	dateSlot *expected = (dateSlot*)malloc(sizeof(dateSlot) * (n > 0 ? n : 1));
+	date bounds[7] = {{1, 1, 1900}, {1, 1, 3000}};
+	int ok = 1, nb = 2;
+	
+	if(n > 0) {
+		long at[5] = {0, n / 3, n / 2, 2 * n / 3, n - 1};
+		for(int k = 0; k < 5; k++) bounds[nb++] = it->cols.row[at[k]]->date_of_payment;
+	}
+	
+	for(int a = 0; a < nb && ok; a++) {
+		for(int b = 0; b < nb && ok; b++) {
+			
+			long found = scanDates(it, dateKey(bounds[a]), dateKey(bounds[b]), expected), k = 0;
+			dateCursor cur;
+			dateRangeOpen(&cur, it, bounds[a], bounds[b]);
+			
+			for(node *temp = dateRangeNext(&cur); temp != NULL && ok; temp = dateRangeNext(&cur), k++) {
+				ok = k < found && temp == it->cols.row[expected[k].pos];
+			}
+			
+			ok = ok && k == found;
+		}
+	}
+	
+	free(expected);
+	return ok;
+}
+
+static int compareAmounts(const void *a, const void *b);
+
+// The amount order-statistics tree against a sorted array of the successful amounts : every rank, select and range.
+
+static int checkAmounts(item *it) {
+	
+	txColumns *cols = &(it->cols);
+	float *sorted = (float*)malloc(sizeof(float) * (cols->count > 0 ? cols->count : 1));
+	long n = 0;
+	int ok = 1;
+	
+	for(long i = 0; i < cols->count; i++) {
+		if(cols->status[i] == 'S' || cols->status[i] == 's') sorted[n++] = cols->amount[i];
+	}
+	
+	qsort(sorted, n, sizeof(float), compareAmounts);
+	
+	for(long k = 0; k < n && ok; k++) {
+		
+		long below = 0, upTo = 0;
+		for(long j = 0; j < n; j++) {
+			below += sorted[j] < sorted[k];
+			upTo += sorted[j] <= sorted[k];
+		}
+		
+		ok = amountSelect(it->amounts, k) == sorted[k] && amountCountBelow(it->amounts, sorted[k], 0) == below && 
+		     amountCountBelow(it->amounts, sorted[k], 1) == upTo;
+	}
+	
+	float edges[4] = {-1.0f, (n > 0) ? sorted[n / 4] : 0.0f, (n > 0) ? sorted[n / 2] : 0.0f, 1e12f};
+	
+	for(int a = 0; a < 4 && ok; a++) {
+		for(int b = 0; b < 4 && ok; b++) {
+			long inside = 0;
+			for(long j = 0; j < n; j++) inside += sorted[j] >= edges[a] && sorted[j] <= edges[b];
+			ok = amountRangeCount(it->amounts, edges[a], edges[b]) == inside;
+		}
+	}
+	
+	ok = ok && amountSelect(it->amounts, n) == 0.0f;
+	
+	free(sorted);
+	return ok;
+}
+
+/* The day and month rollups against a scan of the rows, for ranges between the periods of a few rows and beyond 
+* both ends. The flagged counts must match the current rule verdicts.
+*/
+static int checkRollups(item *it) {
+	
+	txColumns *cols = &(it->cols);
+	const txFeatures *f = historyFeatures(it);
+	long n = cols->count;
+	int ok = 1;
+	
+	for(int t = 0; t < 2 && ok; t++) {
+		
+		const rollupTable *table = (t == 0) ? &(cols->days) : &(cols->months);
+		long periods[7] = {table->first - 5, table->first + table->buckets + 5};
+		int np = 2;
+		
+		if(n > 0) {
+			long at[5] = {0, n / 3, n / 2, 2 * n / 3, n - 1};
+			for(int k = 0; k < 5; k++) {
+				date d = cols->row[at[k]]->date_of_payment;
+				periods[np++] = (t == 0) ? dayNumber(d) : monthNumber(d);
+			}
+		}
+		
+		for(int a = 0; a < np && ok; a++) {
+			for(int b = 0; b < np && ok; b++) {
+				
+				rollup expected = {0, 0.0, 0.0, 0, 0};
+				
+				for(long i = 0; i < n; i++) {
+					
+					date d = cols->row[i]->date_of_payment;
+					long period = (t == 0) ? dayNumber(d) : monthNumber(d);
+					if(period < periods[a] || period > periods[b]) continue;
+					
+					expected.count++;
+					expected.sum += cols->amount[i];
+					expected.sumSq += (double)cols->amount[i] * cols->amount[i];
+					expected.failed += (cols->status[i] == 'f' || cols->status[i] == 'F');
+					expected.flagged += (f->rules[i] != 0);
+				}
+				
+				rollup r = rollupRange(table, periods[a], periods[b]);
+				
+				// the sums are differences of prefix sums, equal up to rounding
+				ok = r.count == expected.count && r.failed == expected.failed && r.flagged == expected.flagged && 
+				     fabs(r.sum - expected.sum) <= 1e-9 * (1.0 + fabs(expected.sum)) && fabs(r.sumSq - expected.sumSq) <= 1e-9 * (1.0 + expected.sumSq);
+			}
+		}
+	}
+	
+	return ok;
+}
+
+/* The spending profile, for a window of transactions and a window of days : built at once as at load (buildProfile) 
+* and row by row as appendCsvRows does it, both against the mean and standard deviation of the window by a scan.
+* The window is switched off again afterwards.
+*/
+static int checkProfile(item *it) {
+	
+	txColumns *cols = &(it->cols);
+	long windows[2][2] = {{20, 0}, {0, 30}};
+	int ok = 1;
+	
+	for(int w = 0; w < 2 && ok && cols->count > 0; w++) {
+		
+		setProfileWindow(windows[w][0], windows[w][1]);
+		buildProfile(it);
+		
+		spendProfile live;
+		memset(&live, 0, sizeof(live));
+		
+		for(long i = 0; i < cols->count; i++) {
+			if(cols->status[i] == 'S' || cols->status[i] == 's') profilePush(&live, cols->amount[i], cols->epoch[i]);
+			profileExpire(&live, cols->epoch[i]);
+		}
+		
+		long long now = cols->epoch[cols->count - 1];
+		double sum = 0.0, sumSq = 0.0;
+		long inWindow = 0;
+		
+		for(long i = cols->count - 1; i >= 0; i--) {
+			
+			if(!(cols->status[i] == 'S' || cols->status[i] == 's')) continue;
+			if(windows[w][0] > 0 && inWindow == windows[w][0]) break;
+			if(windows[w][1] > 0 && cols->epoch[i] < now - windows[w][1] * 86400LL) break;
+			
+			sum += cols->amount[i];
+			sumSq += (double)cols->amount[i] * cols->amount[i];
+			inWindow++;
+		}
+		
+		double mean = (inWindow > 0) ? sum / inWindow : 0.0;
+		double var = (inWindow > 0) ? sumSq / inWindow - mean * mean : 0.0;
+		double stdDev = sqrt(var > 0 ? var : 0);
+		
+		const spendProfile *profiles[2] = {&(it->profile), &live};
+		
+		for(int k = 0; k < 2 && ok; k++) {
+			double m, sd;
+			ok = profileStats(profiles[k], &m, &sd) == inWindow && fabs(m - mean) <= 1e-3 && fabs(sd - stdDev) <= 1e-3;	// amounts are kept in units of 1/10000
+		}
+		
+		freeProfile(&live);
+	}
+	
+	setProfileWindow(0, 0);
+	buildProfile(it);
+	
+	return ok;
+}
+
+/* loadRuleConfig on a file of bad lines : each one is reported and skipped and leaves its setting alone, 
+* the one good line is applied, and a missing file changes nothing. The settings are restored afterwards.
+*/
+static int checkRuleConfig(void) {
+	
+	const char *confName = "selftest_rules.conf";
+	ruleConfig saved = *ruleSettings();
+	FILE *fp = fopen(confName, "w");
+	
+	if(fp == NULL) return 0;
+	
+	fprintf(fp, "# comment\n\nnot a setting\nno_such_key = 1\noutlier_z = abc\nfailed_run = 0\n");
+	fprintf(fp, "rules = outlier, no_such_rule\nbucket_low = %g\nfrequent_run = %d\n", saved.bucketHigh + 1, saved.frequentRun + 4);
+	fclose(fp);
+	
+	int skipped = loadRuleConfig(confName);	// 5 bad lines, and bucket_low above bucket_high
+	
+	ruleConfig expected = saved;
+	expected.frequentRun = saved.frequentRun + 4;
+	int ok = skipped == 6 && memcmp(ruleSettings(), &expected, sizeof(ruleConfig)) == 0;
+	
+	fp = fopen(confName, "w");
+	if(fp != NULL) {
+		fprintf(fp, "frequent_run = %d\n", saved.frequentRun);
+		fclose(fp);
+	}
+	
+	ok = loadRuleConfig(confName) == 0 && ok;
+	remove(confName);
+	ok = loadRuleConfig(confName) == -1 && memcmp(ruleSettings(), &saved, sizeof(ruleConfig)) == 0 && ok;
+	
+	return ok;
+}
+
+static int checkTravel(void);
+
+/* Checks run on every scratch history, one line of output each.
+*/
+static const struct {
+	
+	const char *name;
+	int (*check)(item *it);
+	
+}historyChecks[] = {
+	{"date range cursor", checkDateRanges},
+	{"amount order statistics", checkAmounts},
+	{"day and month rollups", checkRollups},
+	{"spending profile", checkProfile},
+};
+
+/* Self check (./credit --selftest), the regression test of the loaders and the lookups :
+* - every parser (readCsv, readCsvMmap with each row splitter this cpu supports) gives the same rows for each user's csv,
+* - a snapshot written from the csv reads back to the same rows, statistics and date order,
+* - the Robin Hood map, the sharded map and the perfect hash index find every user of users.csv and nothing else,
+*   and a repeated card number is indexed once,
+* - the rule config parser skips bad lines, and the travel rule agrees with the haversine distance row by row,
+* - the indexes of a history loaded in two steps (historyChecks) agree with scans of its rows.
+* Temporary files are written to the working directory and removed. Returns the number of failed checks.
+*/
+int selfTest(void) {
+	
+	int failures = 0;
+	struct stat st;
+	FILE *fp = fopen("users.csv", "r");
+	
+	if(fp == NULL || fstat(fileno(fp), &st) < 0) {
+		printf(RED "Could not open users.csv\n" RESET);
+		if(fp != NULL) fclose(fp);
+		return 1;
+	}
+	
+	long n = 0, cap = 64;
+	user *users = (user*)malloc(sizeof(user) * cap);
+	char *line = getLine(&fp);	// header
+	free(line);
+	
+	while(1) {
+		
+		line = getLine(&fp);
+		
+		if(strcmp(line, "") == 0) {
+			break;
+		}
+		
+		user client = {0};
+		
+		if(parseUser(line, &client) == 1) {
+			if(n == cap) {
+				cap *= 2;
+				users = (user*)realloc(users, sizeof(user) * cap);
+			}
+			users[n++] = client;
+		}
+		
+		free(line);
+	}
+	
+	free(line);
+	fclose(fp);
+	
+	// Parsers : readCsv keeps only the first 19 characters of an id, the mmap parsers must agree with it on everything else.
+	
+	const char *names[] = {"scalar", "SSE2", "AVX2"};
+	int levels[] = {SPLIT_SCALAR, SPLIT_SSE2, SPLIT_AVX2};
+	
+	for(long u = 0; u < n; u++) {
+		
+		char csvName[64];
+		snprintf(csvName, sizeof(csvName), "%s.csv", users[u].name);
+		
+		FILE *csv = fopen(csvName, "r");
+		if(csv == NULL) continue;	// a user without a history
+		
+		dll reference, scalar;
+		init_dll(&reference);
+		init_dll(&scalar);
+		readCsv(&reference, &csv);
+		fclose(csv);
+		
+		long rows = 0;
+		for(node *temp = reference.head; temp != NULL; temp = temp->next) rows++;
+		
+		int ok = 1, parsers = 1;
+		
+		for(int k = 0; k < 3; k++) {
+			
+			if(setRowSplitter(levels[k]) != levels[k]) continue;
+			
+			char what[128];
+			snprintf(what, sizeof(what), "%s, readCsvMmap %s", csvName, names[k]);
+			
+			dll list;
+			init_dll(&list);
+			
+			if(readCsvMmap(&list, csvName, NULL) == -1) {
+				printf(RED "%s : could not be read\n" RESET, what);
+				ok = 0;
+				continue;
+			}
+			
+			ok &= sameHistory(what, reference, list, 19);
+			if(k == 0) scalar = list;
+			else {
+				ok &= sameHistory(what, scalar, list, sizeof(list.head->transaction_id));
+				freeList(&list);
+			}
+			parsers++;
+		}
+		
+		setRowSplitter(SPLIT_BEST);
+		
+		printf("%-24s %6ld rows, %d parsers %s\n", csvName, rows, parsers, ok ? "agree" : "DIFFER");
+		failures += !ok;
+		
+		// Snapshot round trip, from the rows of the scalar parser.
+		
+		item written, read;
+		memset(&written, 0, sizeof(written));
+		memset(&read, 0, sizeof(read));
+		written.list = scalar;
+		written.mean = calculateMean(&scalar);
+		written.stdDev = calculateStandardDeviation(&scalar);
+		read.pool = arenaCreate(ARENA_CHUNK);
+		read.list.pool = read.pool;
+		
+		const char *snapName = "selftest.snap";
+		ok = writeSnapshot(&written, csvName, snapName) == 0 && readSnapshot(&read, csvName, snapName, NULL) == 0;
+		
+		if(!ok) printf(RED "%s : the snapshot could not be written or read back\n" RESET, csvName);
+		else {
+			dateIndex expected;
+			indexListDates(&expected, scalar, rows);
+			
+			ok = sameHistory("snapshot", scalar, read.list, sizeof(scalar.head->transaction_id)) && read.mean == written.mean && read.stdDev == written.stdDev && 
+			     read.dates.count == rows && memcmp(read.dates.order, expected.order, sizeof(int) * rows) == 0;
+			
+			freeDateIndex(&expected);
+		}
+		
+		printf("%-24s %6ld rows, snapshot round trip %s\n", csvName, rows, ok ? "ok" : "FAILED");
+		failures += !ok;
+		
+		remove(snapName);
+		freeHistory(&read);
+		freeList(&scalar);
+		freeList(&reference);
+	}
+	
+	// Lookups : every card in all three structures, with the right owner, and a card nobody has in none of them.
+	
+	Map *map = initHashMap();
+	ConcurrentMap *cm = initConcurrentMap();
+	const char *indexName = "selftest_users.idx";
+	
+	for(long u = 0; u < n; u++) {
+		enter_users(map, users[u]);
+		cmapEnterUser(cm, users[u]);
+	}
+	
+	userIndex *ix = (writeUserIndex(users, n, indexName, 0, 0) == 0) ? openUserIndex(indexName, NULL) : NULL;
+	int ok = (ix != NULL);
+	
+	for(long u = 0; ok && u < n; u++) {
+		
+		item *a = find(map, users[u].cardNo);
+		item *b = cmapFind(cm, users[u].cardNo);
+		const user *c = indexFind(ix, users[u].cardNo);
+		
+		ok = a != NULL && b != NULL && c != NULL && strcmp(a->client.name, users[u].name) == 0 && 
+		     strcmp(b->client.name, users[u].name) == 0 && strcmp(c->name, users[u].name) == 0;
+	}
+	
+	ok = ok && find(map, 1) == NULL && cmapFind(cm, 1) == NULL && indexFind(ix, 1) == NULL;
+	
+	printf("%-24s %6ld users, map, sharded map and index %s\n", "users.csv", n, ok ? "agree" : "DIFFER");
+	failures += !ok;
+	
+	if(ix != NULL) closeUserIndex(ix);
+	remove(indexName);
+	
+	// A repeated card : writeUserIndex refuses it, buildUserIndex keeps the first row as the map does.
+	
+	ok = n > 0;
+	
+	if(ok) {
+		
+		user *twice = (user*)malloc(sizeof(user) * (n + 1));
+		memcpy(twice, users, sizeof(user) * n);
+		twice[n] = users[0];
+		strcpy(twice[n].name, "Repeated");
+		ok = writeUserIndex(twice, n + 1, indexName, 0, 0) == -1;
+		free(twice);
+		
+		const char *usersName = "selftest_users.csv";
+		FILE *in = fopen("users.csv", "r"), *out = fopen(usersName, "w");
+		int c;
+		
+		if(in != NULL && out != NULL) {
+			while((c = fgetc(in)) != EOF) fputc(c, out);
+			const user *r = &users[0];
+			fprintf(out, "Repeated,%lx,%d,%d/%d/%d,%s,%s,%s,%s\n", r->cardNo, r->cvv, r->expiryDate.day, r->expiryDate.month, r->expiryDate.year, 
+				r->password, r->address.country, r->address.state, r->address.city);
+		}
+		
+		if(in != NULL) fclose(in);
+		if(out != NULL) fclose(out);
+		
+		ok = ok && buildUserIndex(usersName, indexName) == n;
+		ix = ok ? openUserIndex(indexName, usersName) : NULL;
+		ok = ix != NULL;
+		
+		for(long u = 0; ok && u < n; u++) {
+			const user *found = indexFind(ix, users[u].cardNo);
+			ok = found != NULL && strcmp(found->name, users[u].name) == 0;
+		}
+		
+		if(ix != NULL) closeUserIndex(ix);
+		remove(usersName);
+		remove(indexName);
+	}
+	
+	printf("%-24s %6ld users, repeated card %s\n", "users.csv", n, ok ? "ok" : "FAILED");
+	failures += !ok;
+	
+	ok = checkRuleConfig();
+	printf("%-24s bad lines skipped, rule config %s\n", "rules.conf", ok ? "ok" : "FAILED");
+	failures += !ok;
+	
+	ok = checkTravel();
+	printf("%-24s every pair of places, impossible travel %s\n", "zipcodes.csv", ok ? "ok" : "FAILED");
+	failures += !ok;
+	
+	// Histories : each user's csv loaded half, then appended, and every index checked against a scan.
+	
+	for(long u = 0; u < n; u++) {
+		
+		char csvName[64];
+		snprintf(csvName, sizeof(csvName), "%s.csv", users[u].name);
+		
+		item *it = selfTestHistory(&users[u], csvName);
+		if(it == NULL) continue;
+		
+		for(size_t k = 0; k < sizeof(historyChecks) / sizeof(historyChecks[0]); k++) {
+			ok = historyChecks[k].check(it);
+			printf("%-24s %6ld rows, %s %s\n", csvName, it->cols.count, historyChecks[k].name, ok ? "ok" : "FAILED");
+			failures += !ok;
+		}
+		
+		freeHistory(it);
+		free(it);
+	}
+	
+	Map *maps[MAP_SHARDS + 1];
+	maps[0] = map;
+	for(int i = 0; i < MAP_SHARDS; i++) {
+		maps[i + 1] = cm->shard[i].map;
+		pthread_rwlock_destroy(&cm->shard[i].lock);
+	}
+	
+	for(int i = 0; i <= MAP_SHARDS; i++) {
+		for(int k = 0; k < maps[i]->size; k++) {
+			if(maps[i]->slots[k].dist != 0) free(maps[i]->slots[k].value);
+		}
+		free(maps[i]->slots);
+		free(maps[i]);
+	}
+	
+	free(cm);
+	free(users);
+	
+	printf("%s%d failed checks\n" RESET, failures ? RED : CYAN, failures);
+	
+	return failures;
+}
+
+/*Purpose :  To create a copy of the linked list, so that this could be used to create a binary search tree.
+ * Time Complexity : O(N), where N is the number of elements in the doubly linked list.
+*/
+node *copyList(dll list) {
+	node *temp = list.head;
+	node *p;
+	node dummy;
+	
+	p = &dummy;
+	
+	while(temp != NULL) {
+		node *new = (node*)malloc(sizeof(node));
+		new->transaction_id[0] = temp->transaction_id[0];
+		new->time_of_payment = temp->time_of_payment;
+		new->payment_place = temp->payment_place;
+		new->zipCode = temp->zipCode;
+		new->amount = temp->amount;
+		new->status = temp->status;
+		new->date_of_payment = temp->date_of_payment;
+		
+		p->next = new;
+		p = p->next;
+		temp = temp->next;
+	} 
+	
+	p->next = NULL;
+	
+	return dummy.next;
+}	
+
+/* The function findMiddle finds the middle node of a singly linked list, which is typically done using 
+ * the tortoise and hare approach (using two pointers: slow and fast).
+ * it takes half as many iterations to reach the end of the list as the total number of nodes.
+ * The overall Time Complexity is O(N).
+*/
+
+node* findMiddle(node *head) {
+    
+    if (head == NULL) return NULL;
+    node *slow = head;
+    node *fast = head;
+    node *prev = NULL;
+
+    while (fast != NULL && fast->next != NULL) {
+        prev = slow;
+        slow = slow->next;
+        fast = fast->next->next;
+    }
+
+    // Disconnect left half
+    if (prev != NULL) {
+        prev->next = NULL;
+    }
+
+    return slow; // Middle node
+}
+
+/* Time Complexity: O(NlogN), where N is the total number of nodes.
+*/
+
+transaction *sortedToBST(node *head) {
+	
+	if(head == NULL) return NULL;
+	
+	node *new = findMiddle(head);
+    	transaction* root = (transaction*)malloc(sizeof(transaction));
+    	root->date_of_payment = new->date_of_payment;
+    	root->time_of_payment = new->time_of_payment;
+    	root->payment_place = new->payment_place;
+    	root->amount = new->amount;
+    	root->status = new->status;
+    	
+    	if(head == new) {
+		root->left = NULL;
+		root->right = NULL;
+        
+    	}
+    	
+    	else {
+        
+		root->left = sortedToBST(head); // Left half
+		root->right = sortedToBST(new->next); // Right half
+    	}
+    	
+    	return root;
+}
+
+
+
+float calculateMean(dll *list) {
+    node *temp = list->head;
+    float mean = 0.00;
+    int count = 0;
+    
+    // Traverse the linked list and sum the amounts
+    while (temp != NULL) {
+    
+    	if (temp->status == 'S' || temp->status == 's') {
+		mean = mean + temp->amount;  // Accumulate the amount
+		count++;  // Increment the count
+	}
+	
+        temp = temp->next;  // Move to the next node
+    }
+
+    // Check for an empty list (avoid division by zero)
+    if (count == 0) {
+        printf("List is empty, returning 0.0\n");
+        return 0.0;
+    }
+
+    // Calculate mean
+    mean = mean /((float)count);
+
+    return mean;
+}
+
+/* Function to calculate the standard deviation of transaction amounts
+ Formula:
+ * Standard Deviation (σ) = sqrt( (1/n) * Σ(xi - μ)^2 )
+ * Where:
+ * - xi is each individual transaction amount
+ * - μ is the mean of all transaction amounts
+ * - n is the total number of transactions
+ * The function calculates the squared difference between each transaction amount and the mean, 
+ * sums these squared differences, and returns the square root of the average squared difference.
+*/
+
+float calculateStandardDeviation(dll *list) {
+    
+    float mean = calculateMean(list);
+    node *temp = list->head;
+    int count = 0;
+    float sum = 0.0;
+    while(temp != NULL) {
+        if (temp->status == 'S' || temp->status == 's') {
+		float diff = temp->amount - mean;
+		sum += diff * diff;
+		count++;
+        }
+        temp = temp->next;
+        
+    }
+    return sqrt(sum / (float)count);
+}
+
+/* Packs a date into a single comparable key, yyyymmdd.
+*/
+int dateKey(date d) {
+	return d.year * 10000 + d.month * 100 + d.day;
+}
+
+/* Writes the loaded history of endUser as a binary snapshot : 
+* header (magic, version, size and mtime of the source csv, count, mean, stdDev), 
+* the packed records in list order, then the date index (record positions sorted by date).
+* The file is written under a temporary name and renamed, so a reader never maps a half written snapshot.
+* Returns 0 on success, -1 on failure.
+* Time Complexity : O(NlogN) for sorting the date index.
+*/
+int writeSnapshot(item *endUser, const char *csvName, const char *snapName) {
+	
+	struct stat st;
+	if(stat(csvName, &st) < 0) return -1;
+	
+	long count = 0;
+	for(node *temp = endUser->list.head; temp != NULL; temp = temp->next) count++;
+	
+	snapRecord *records = (snapRecord*)calloc(count > 0 ? count : 1, sizeof(snapRecord));
+	dateSlot *slots = (dateSlot*)malloc(sizeof(dateSlot) * (count > 0 ? count : 1));
+	int *index = (int*)malloc(sizeof(int) * (count > 0 ? count : 1));
+	
+	/* Location ids are only meaningful inside this process, so the snapshot carries its own string table : 
+	* local[id] is the position in names of the global id, names holds the strings this history uses.
+	*/
+	int globalCount = locationCount();
+	int *local = (int*)malloc(sizeof(int) * (globalCount > 0 ? globalCount : 1));
+	char (*names)[DICT_NAME] = (char(*)[DICT_NAME])calloc(globalCount > 0 ? globalCount : 1, DICT_NAME);
+	long nameCount = 0;
+	
+	for(int k = 0; k < globalCount; k++) local[k] = -1;
+	
+	long i = 0;
+	for(node *temp = endUser->list.head; temp != NULL; temp = temp->next, i++) {
+		memcpy(records[i].transaction_id, temp->transaction_id, sizeof(records[i].transaction_id));
+		records[i].date_of_payment = temp->date_of_payment;
+		records[i].hour = temp->time_of_payment.tm_hour;
+		records[i].min = temp->time_of_payment.tm_min;
+		records[i].sec = temp->time_of_payment.tm_sec;
+		records[i].status = temp->status;
+		
+		int *ids[3] = {&records[i].payment_place.city, &records[i].payment_place.state, &records[i].payment_place.country};
+		int global[3] = {temp->payment_place.city, temp->payment_place.state, temp->payment_place.country};
+		
+		for(int k = 0; k < 3; k++) {
+			if(global[k] < 0 || global[k] >= globalCount) {
+				*ids[k] = -1;
+				continue;
+			}
+			if(local[global[k]] == -1) {
+				local[global[k]] = nameCount;
+				strncpy(names[nameCount++], locationName(global[k]), DICT_NAME - 1);
+			}
+			*ids[k] = local[global[k]];
+		}
+		
+		records[i].zipCode = temp->zipCode;
+		records[i].amount = temp->amount;
+		records[i].epoch = temp->epoch;
+		slots[i].key = dateKey(temp->date_of_payment);
+		slots[i].pos = i;
+	}
+	
+	if(endUser->dates.count == count && endUser->recent == NULL) {
+		memcpy(index, endUser->dates.order, sizeof(int) * count);	// nothing appended since the load, the date index has the order
+	}
+	
+	else {
+		qsort(slots, count, sizeof(dateSlot), compareDateSlots);
+		
+		for(i = 0; i < count; i++) {
+			index[i] = slots[i].pos;
+		}
+	}
+	
+	free(slots);
+	
+	snapHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = SNAP_MAGIC;
+	h.version = SNAP_VERSION;
+	h.csvSize = st.st_size;
+	h.csvMtime = st.st_mtime;
+	h.count = count;
+	h.mean = endUser->mean;
+	h.stdDev = endUser->stdDev;
+	h.recordOffset = sizeof(snapHeader);
+	h.indexOffset = h.recordOffset + count * sizeof(snapRecord);
+	h.stringOffset = h.indexOffset + count * sizeof(int);
+	h.stringCount = nameCount;
+	
+	char tmpName[300];
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", snapName);
+	
+	FILE *fp = fopen(tmpName, "wb");
+	int ok = (fp != NULL);
+	
+	if(ok) {
+		ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+		if(ok && count > 0) ok = fwrite(records, sizeof(snapRecord), count, fp) == (size_t)count;
+		if(ok && count > 0) ok = fwrite(index, sizeof(int), count, fp) == (size_t)count;
+		if(ok && nameCount > 0) ok = fwrite(names, DICT_NAME, nameCount, fp) == (size_t)nameCount;
+		ok = (fclose(fp) == 0) && ok;
+	}
+	
+	if(ok) ok = rename(tmpName, snapName) == 0;
+	if(!ok) remove(tmpName);
+	
+	free(records);
+	free(index);
+	free(local);
+	free(names);
+	
+	return ok ? 0 : -1;
+}
+
+/* Maps a snapshot and rebuilds the list, the BST and the statistics of endUser from it.
+* The snapshot is only used if its magic and version match, the size and mtime recorded in it 
+* still match the csv and its layout and date order are consistent, otherwise -1 is returned and the caller 
+* falls back to the csv (a snapshot is only a cache, a corrupt one must never stop a login).
+* Time Complexity : O(N), no parsing and no sorting is needed.
+*/
+int readSnapshot(item *endUser, const char *csvName, const char *snapName, loadStats *stats) {
+	
+	double start = nowSeconds();
+	struct stat csvStat, st;
+	
+	if(stat(csvName, &csvStat) < 0) return -1;
+	
+	int fd = open(snapName, O_RDONLY);
+	if(fd < 0) return -1;
+	
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(snapHeader)) {
+		close(fd);
+		return -1;
+	}
+	
+	const char *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(buf == MAP_FAILED) return -1;
+	
+	const snapHeader *h = (const snapHeader*)buf;
+	
+	// the counts are bounded by the file size first, so none of the products below can overflow
+	int sane = h->count >= 0 && h->count <= st.st_size / (long long)sizeof(snapRecord) && h->stringCount >= 0 && h->stringCount <= st.st_size / DICT_NAME;
+	
+	if(!sane || h->magic != SNAP_MAGIC || h->version != SNAP_VERSION || h->csvSize != csvStat.st_size || h->csvMtime != csvStat.st_mtime || 
+	   h->recordOffset != (long long)sizeof(snapHeader) || h->indexOffset != h->recordOffset + h->count * (long long)sizeof(snapRecord) || 
+	   h->stringOffset != h->indexOffset + h->count * (long long)sizeof(int) || h->stringOffset + h->stringCount * (long long)DICT_NAME != st.st_size) {
+		munmap((void*)buf, st.st_size);
+		return -1;
+	}
+	
+	const snapRecord *records = (const snapRecord*)(buf + h->recordOffset);
+	const int *index = (const int*)(buf + h->indexOffset);
+	
+	/* The date order must be a permutation of the records in date order, otherwise the snapshot is corrupt. 
+	* Checked before anything is added to the list, so a bad snapshot leaves nothing behind.
+	*/
+	unsigned char *seen = (unsigned char*)calloc(h->count > 0 ? h->count : 1, 1);
+	int valid = 1;
+	
+	for(long long i = 0; i < h->count && valid; i++) {
+		
+		int k = index[i];
+		
+		if(k < 0 || k >= h->count || seen[k]) valid = 0;
+		else if(i > 0 && dateKey(records[index[i - 1]].date_of_payment) > dateKey(records[k].date_of_payment)) valid = 0;
+		else seen[k] = 1;
+	}
+	
+	free(seen);
+	
+	if(!valid) {
+		munmap((void*)buf, st.st_size);
+		return -1;
+	}
+	const char (*names)[DICT_NAME] = (const char(*)[DICT_NAME])(buf + h->stringOffset);
+	
+	// Interns the snapshot's strings once, remap[k] is the global id of its k-th string.
+	int *remap = (int*)malloc(sizeof(int) * (h->stringCount > 0 ? h->stringCount : 1));
+	for(long long k = 0; k < h->stringCount; k++) {
+		remap[k] = internLocation(names[k], names[k] + strnlen(names[k], DICT_NAME - 1));
+	}
+	
+	node *block = (node*)arenaAlloc(endUser->list.pool, sizeof(node) * (h->count > 0 ? h->count : 1));	// one contiguous run of nodes
+	
+	for(long long i = 0; i < h->count; i++) {
+		
+		const snapRecord *r = &records[i];
+		node *newNode = &block[i];
+		
+		memcpy(newNode->transaction_id, r->transaction_id, sizeof(newNode->transaction_id));
+		newNode->date_of_payment = r->date_of_payment;
+		memset(&newNode->time_of_payment, 0, sizeof(newNode->time_of_payment));
+		newNode->time_of_payment.tm_hour = r->hour;
+		newNode->time_of_payment.tm_min = r->min;
+		newNode->time_of_payment.tm_sec = r->sec;
+		newNode->payment_place.city = (r->payment_place.city >= 0 && r->payment_place.city < h->stringCount) ? remap[r->payment_place.city] : -1;
+		newNode->payment_place.state = (r->payment_place.state >= 0 && r->payment_place.state < h->stringCount) ? remap[r->payment_place.state] : -1;
+		newNode->payment_place.country = (r->payment_place.country >= 0 && r->payment_place.country < h->stringCount) ? remap[r->payment_place.country] : -1;
+		newNode->zipCode = r->zipCode;
+		newNode->amount = r->amount;
+		newNode->status = r->status;
+		newNode->epoch = r->epoch;
+		newNode->prev = NULL;
+		newNode->next = NULL;
+		
+		insertEnd(&(endUser->list), newNode);
+	}
+	
+	free(remap);
+	
+	// the snapshot already holds the date order, so the date index is built without sorting
+	int *keys = (int*)malloc(sizeof(int) * (h->count > 0 ? h->count : 1));
+	int *order = (int*)malloc(sizeof(int) * (h->count > 0 ? h->count : 1));
+	
+	for(long long i = 0; i < h->count; i++) {
+		order[i] = index[i];
+		keys[i] = dateKey(block[index[i]].date_of_payment);
+	}
+	
+	buildDateIndex(&(endUser->dates), keys, order, h->count);
+	free(keys);
+	endUser->recent = NULL;
+	endUser->mean = h->mean;
+	endUser->stdDev = h->stdDev;
+	endUser->csvBytes = h->csvSize;
+	
+	if(stats != NULL) {
+		stats->bytes = st.st_size;
+		stats->rows = h->count;
+		stats->seconds = nowSeconds() - start;
+		stats->source = 1;
+	}
+	
+	munmap((void*)buf, st.st_size);
+	return 0;
+}
+
+/* Loads the transaction history of endUser at login.
+* <Name>.snap is tried first. If it is missing or stale, <Name>.csv is parsed, the BST and the statistics 
+* are computed as before, and a fresh snapshot is written for the next login.
+* Returns 1 when the snapshot was used, 0 when the csv was parsed and -1 if neither could be read.
+*/
+int loadUserHistory(item *endUser, loadStats *stats) {
+	
+	char csvName[64], snapName[64];
+	snprintf(csvName, sizeof(csvName), "%s.csv", endUser->client.name);
+	snprintf(snapName, sizeof(snapName), "%s.snap", endUser->client.name);
+	
+	loadStats local;
+	if(stats == NULL) stats = &local;
+	
+	double start = nowSeconds();
+	init_dll(&(endUser->list));
+	endUser->recent = NULL;
+	endUser->amounts = NULL;
+	memset(&(endUser->dates), 0, sizeof(endUser->dates));
+	memset(&(endUser->features), 0, sizeof(endUser->features));
+	endUser->pool = arenaCreate(ARENA_CHUNK);
+	endUser->list.pool = endUser->pool;
+	
+	if(readSnapshot(endUser, csvName, snapName, stats) == 0) {
+		buildColumns(&(endUser->cols), endUser->list, stats->rows);
+		endUser->amounts = buildAmountTree(endUser->pool, &(endUser->cols));
+		buildProfile(endUser);
+		seedRunningStats(endUser);
+		historyFeatures(endUser);	// the rule stage fills the flagged column of the rollups
+		endUser->loaded = 1;
+		endUser->memBytes = endUser->pool->reserved + columnsBytes(&(endUser->cols)) + dateIndexBytes(&(endUser->dates));
+		stats->source = 1;
+		return 1;
+	}
+	
+	if(readCsvMmap(&(endUser->list), csvName, stats) == -1) {
+		arenaDestroy(endUser->pool);
+		endUser->pool = NULL;
+		init_dll(&(endUser->list));
+		stats->source = -1;
+		return -1;
+	}
+	
+	indexListDates(&(endUser->dates), endUser->list, stats->rows);
+	buildColumns(&(endUser->cols), endUser->list, stats->rows);
+	endUser->amounts = buildAmountTree(endUser->pool, &(endUser->cols));
+	columnStats(&(endUser->cols), &(endUser->mean), &(endUser->stdDev));
+	buildProfile(endUser);
+	endUser->csvBytes = stats->bytes;
+	seedRunningStats(endUser);
+	
+	stats->seconds = nowSeconds() - start;	// parse + BST + statistics, comparable to the snapshot path
+	stats->source = 0;
+	historyFeatures(endUser);
+	endUser->loaded = 1;
+	endUser->memBytes = endUser->pool->reserved + columnsBytes(&(endUser->cols)) + dateIndexBytes(&(endUser->dates));
+	
+	if(writeSnapshot(endUser, csvName, snapName) == -1) {
+		printf(YELLOW "Could not write the snapshot %s\n", snapName);
+	}
+	
+	return 0;
+}
+
+/* Seeds the running (Welford) accumulators from the mean and stdDev computed at load time, 
+* so that later appends can update them without another pass over the amounts.
+* Only the number of successful transactions has to be counted : M2 = n * stdDev^2.
+* Time Complexity : O(N), once per load.
+*/
+void seedRunningStats(item *endUser) {
+	
+	long n = 0;
+	
+	for(node *temp = endUser->list.head; temp != NULL; temp = temp->next) {
+		if(temp->status == 'S' || temp->status == 's') n++;
+	}
+	
+	endUser->statCount = n;
+	endUser->runMean = endUser->mean;
+	endUser->runM2 = (double)endUser->stdDev * endUser->stdDev * n;
+}
+
+/* Welford's update of the mean and standard deviation for one new transaction.
+* Like calculateMean and calculateStandardDeviation only successful transactions are counted.
+* Time Complexity : O(1).
+*/
+void updateRunningStats(item *endUser, node *newNode) {
+	
+	if(newNode->status != 'S' && newNode->status != 's') return;
+	
+	endUser->statCount++;
+	
+	double delta = newNode->amount - endUser->runMean;
+	endUser->runMean += delta / endUser->statCount;
+	endUser->runM2 += delta * (newNode->amount - endUser->runMean);
+	
+	endUser->mean = endUser->runMean;
+	endUser->stdDev = sqrt(endUser->runM2 / endUser->statCount);
+}
+
+static int dateTreeHeight(dateNode *t) {
+	return (t == NULL) ? 0 : t->height;
+}
+
+static void dateTreeFix(dateNode *t) {
+	
+	int l = dateTreeHeight(t->left), r = dateTreeHeight(t->right);
+	t->height = 1 + (l > r ? l : r);
+}
+
+static dateNode *rotateRight(dateNode *t) {
+	
+	dateNode *l = t->left;
+	t->left = l->right;
+	l->right = t;
+	dateTreeFix(t);
+	dateTreeFix(l);
+	
+	return l;
+}
+
+static dateNode *rotateLeft(dateNode *t) {
+	
+	dateNode *r = t->right;
+	t->right = r->left;
+	r->left = t;
+	dateTreeFix(t);
+	dateTreeFix(r);
+	
+	return r;
+}
+
+/* Inserts one appended transaction into the AVL tree of recent dates. 
+* Equal dates go to the right so that an in-order walk keeps the order of arrival; rotations preserve the in-order sequence.
+* Time Complexity : O(logK), where K is the number of transactions appended since the load.
+*/
+dateNode *dateTreeInsert(arena *pool, dateNode *root, int key, int pos) {
+	
+	if(root == NULL) {
+		
+		dateNode *t = (dateNode*)arenaAlloc(pool, sizeof(dateNode));
+		t->key = key;
+		t->pos = pos;
+		t->height = 1;
+		t->left = NULL;
+		t->right = NULL;
+		
+		return t;
+	}
+	
+	if(key < root->key) root->left = dateTreeInsert(pool, root->left, key, pos);
+	else root->right = dateTreeInsert(pool, root->right, key, pos);
+	
+	dateTreeFix(root);
+	
+	int balance = dateTreeHeight(root->left) - dateTreeHeight(root->right);
+	
+	if(balance > 1) {
+		if(dateTreeHeight(root->left->left) < dateTreeHeight(root->left->right)) root->left = rotateLeft(root->left);
+		return rotateRight(root);
+	}
+	
+	if(balance < -1) {
+		if(dateTreeHeight(root->right->right) < dateTreeHeight(root->right->left)) root->right = rotateRight(root->right);
+		return rotateLeft(root);
+	}
+	
+	return root;
+}
+
+// Only for a tree that was not allocated from an arena.
+
+void freeDateTree(dateNode *root) {
+	
+	if(root == NULL) return;
+	
+	freeDateTree(root->left);
+	freeDateTree(root->right);
+	free(root);
+}
+
+/* Amount index : an AVL tree whose nodes also count the amounts below them (size). 
+* Built balanced from the sorted amounts at load, kept balanced by the rotations on append.
+*/
+static int amountHeight(amountNode *t) {
+	return (t == NULL) ? 0 : t->height;
+}
+
+static int amountSize(amountNode *t) {
+	return (t == NULL) ? 0 : t->size;
+}
+
+static void amountFix(amountNode *t) {
+	
+	int l = amountHeight(t->left), r = amountHeight(t->right);
+	t->height = 1 + (l > r ? l : r);
+	t->size = 1 + amountSize(t->left) + amountSize(t->right);
+}
+
+static amountNode *amountRotateRight(amountNode *t) {
+	
+	amountNode *l = t->left;
+	t->left = l->right;
+	l->right = t;
+	amountFix(t);
+	amountFix(l);
+	
+	return l;
+}
+
+static amountNode *amountRotateLeft(amountNode *t) {
+	
+	amountNode *r = t->right;
+	t->right = r->left;
+	r->left = t;
+	amountFix(t);
+	amountFix(r);
+	
+	return r;
+}
+
+static amountNode *sortedToAmountTree(arena *pool, const float *sorted, long lo, long hi) {
+	
+	if(lo > hi) return NULL;
+	
+	long mid = lo + (hi - lo) / 2;
+	
+	amountNode *t = (amountNode*)arenaAlloc(pool, sizeof(amountNode));
+	t->amount = sorted[mid];
+	t->left = sortedToAmountTree(pool, sorted, lo, mid - 1);
+	t->right = sortedToAmountTree(pool, sorted, mid + 1, hi);
+	amountFix(t);
+	
+	return t;
+}
+
+static int compareAmounts(const void *a, const void *b) {
+	
+	float x = *(const float*)a, y = *(const float*)b;
+	
+	return (x > y) - (x < y);
+}
+
+/* Builds the amount index of the successful transactions of the columns.
+* Time Complexity : O(NlogN) for the sort, the tree itself is built in O(N).
+*/
+amountNode *buildAmountTree(arena *pool, txColumns *cols) {
+	
+	float *sorted = (float*)malloc(sizeof(float) * (cols->count > 0 ? cols->count : 1));
+	long n = 0;
+	
+	for(long i = 0; i < cols->count; i++) {
+		if(cols->status[i] == 'S' || cols->status[i] == 's') sorted[n++] = cols->amount[i];
+	}
+	
+	qsort(sorted, n, sizeof(float), compareAmounts);
+	
+	amountNode *root = sortedToAmountTree(pool, sorted, 0, n - 1);
+	free(sorted);
+	
+	return root;
+}
+
+/* Inserts one amount, equal amounts to the right.
+* Time Complexity : O(logN).
+*/
+amountNode *amountTreeInsert(arena *pool, amountNode *root, float amount) {
+	
+	if(root == NULL) {
+		
+		amountNode *t = (amountNode*)arenaAlloc(pool, sizeof(amountNode));
+		t->amount = amount;
+		t->left = NULL;
+		t->right = NULL;
+		amountFix(t);
+		
+		return t;
+	}
+	
+	if(amount < root->amount) root->left = amountTreeInsert(pool, root->left, amount);
+	else root->right = amountTreeInsert(pool, root->right, amount);
+	
+	amountFix(root);
+	
+	int balance = amountHeight(root->left) - amountHeight(root->right);
+	
+	if(balance > 1) {
+		if(amountHeight(root->left->left) < amountHeight(root->left->right)) root->left = amountRotateLeft(root->left);
+		return amountRotateRight(root);
+	}
+	
+	if(balance < -1) {
+		if(amountHeight(root->right->right) < amountHeight(root->right->left)) root->right = amountRotateRight(root->right);
+		return amountRotateLeft(root);
+	}
+	
+	return root;
+}
+
+// Only for a tree that was not allocated from an arena.
+
+void freeAmountTree(amountNode *root) {
+	
+	if(root == NULL) return;
+	
+	freeAmountTree(root->left);
+	freeAmountTree(root->right);
+	free(root);
+}
+
+/* Rank : the number of amounts below amount (or equal to it, with inclusive set).
+* Time Complexity : O(logN).
+*/
+long amountCountBelow(amountNode *root, float amount, int inclusive) {
+	
+	long count = 0;
+	
+	while(root != NULL) {
+		
+		if(root->amount < amount || (inclusive && root->amount == amount)) {
+			count += amountSize(root->left) + 1;
+			root = root->right;
+		}
+		
+		else {
+			root = root->left;
+		}
+	}
+	
+	return count;
+}
+
+// Number of amounts in [low, high].
+
+long amountRangeCount(amountNode *root, float low, float high) {
+	
+	if(high < low) return 0;
+	
+	return amountCountBelow(root, high, 1) - amountCountBelow(root, low, 0);
+}
+
+/* Select : the k-th smallest amount (k from 0), 0 if there are not that many.
+* Time Complexity : O(logN).
+*/
+float amountSelect(amountNode *root, long k) {
+	
+	while(root != NULL) {
+		
+		long left = amountSize(root->left);
+		
+		if(k < left) {
+			root = root->left;
+		}
+		
+		else if(k == left) {
+			return root->amount;
+		}
+		
+		else {
+			k -= left + 1;
+			root = root->right;
+		}
+	}
+	
+	return 0.0;
+}
+
+// Nearest rank percentile, p in (0, 1] : the smallest amount with at least p of the amounts at or below it.
+
+float amountPercentile(amountNode *root, double p) {
+	
+	long n = amountSize(root);
+	long k = (long)ceil(p * n) - 1;
+	
+	if(k < 0) k = 0;
+	if(k >= n) k = n - 1;
+	
+	return amountSelect(root, k);
+}
+
+/* Positions cur on the first transaction dated from or later : a lower bound in the date index, 
+* and the left spine of the appended tree restricted to keys >= from.
+* Time Complexity : O(logN + logK).
+*/
+void dateRangeOpen(dateCursor *cur, const item *endUser, date from, date to) {
+	
+	int lo = dateKey(from);
+	
+	cur->owner = endUser;
+	cur->to = dateKey(to);
+	cur->rank = dateIndexLowerBound(&(endUser->dates), lo);
+	cur->rankEnd = (cur->to < lo) ? cur->rank : dateIndexLowerBound(&(endUser->dates), cur->to + 1);
+	cur->depth = 0;
+	
+	for(dateNode *t = endUser->recent; t != NULL; ) {
+		if(t->key >= lo) {
+			cur->stack[cur->depth++] = t;
+			t = t->left;
+		}
+		else {
+			t = t->right;
+		}
+	}
+}
+
+/* Next transaction of the range in date order, NULL at the end. For equal dates the loaded transactions come first, 
+* then the appended ones, which is the order of arrival.
+* Time Complexity : amortized O(1).
+*/
+node *dateRangeNext(dateCursor *cur) {
+	
+	const item *owner = cur->owner;
+	dateNode *top = (cur->depth > 0 && cur->stack[cur->depth - 1]->key <= cur->to) ? cur->stack[cur->depth - 1] : NULL;
+	
+	if(cur->rank < cur->rankEnd) {
+		
+		node *row = owner->cols.row[owner->dates.order[cur->rank]];
+		
+		if(top == NULL || dateKey(row->date_of_payment) <= top->key) {
+			cur->rank++;
+			return row;
+		}
+	}
+	
+	if(top == NULL) return NULL;
+	
+	cur->depth--;
+	
+	for(dateNode *t = top->right; t != NULL; t = t->left) {
+		cur->stack[cur->depth++] = t;
+	}
+	
+	return owner->cols.row[top->pos];
+}
+
+/* Picks up the rows appended to <Name>.csv since it was loaded.
+* Only complete lines (ending in a newline) are consumed; a row still being written is read on the next call.
+* Every new row is pushed with insertEnd, inserted into the BST and folded into the running mean and stdDev.
+* The rule stage then runs again over the whole history, since the new mean moves every z-score.
+* Returns the number of rows added, or -1 if the file can not be read or has shrunk (it was rewritten, not appended).
+* Time Complexity : O(K⋅h) for K new rows, plus O(N) for the rule stage.
+*/
+long appendCsvRows(item *endUser, const char *csvName) {
+	
+	int fd = open(csvName, O_RDONLY);
+	if(fd < 0) return -1;
+	
+	struct stat st;
+	if(fstat(fd, &st) < 0 || st.st_size < endUser->csvBytes) {
+		close(fd);
+		return -1;
+	}
+	
+	if(st.st_size == endUser->csvBytes) {
+		close(fd);
+		return 0;
+	}
+	
+	const char *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(buf == MAP_FAILED) return -1;
+	
+	const char *p = buf + endUser->csvBytes;
+	const char *end = buf + st.st_size;
+	node *last = endUser->list.end;
+	long added = 0;
+	
+	p = parseRows(&(endUser->list), p, end, 1, &added);
+	
+	for(node *temp = (last == NULL) ? endUser->list.head : last->next; temp != NULL; temp = temp->next) {
+		columnsAppend(&(endUser->cols), temp);
+		endUser->recent = dateTreeInsert(endUser->pool, endUser->recent, dateKey(temp->date_of_payment), endUser->cols.count - 1);
+		
+		if(temp->status == 'S' || temp->status == 's') {
+			endUser->amounts = amountTreeInsert(endUser->pool, endUser->amounts, temp->amount);
+			if(profileEnabled()) profilePush(&(endUser->profile), temp->amount, temp->epoch);
+		}
+		
+		if(profileEnabled()) profileExpire(&(endUser->profile), temp->epoch);
+		updateRunningStats(endUser, temp);
+	}
+	
+	endUser->csvBytes = p - buf;
+	endUser->features.valid = 0;	// new rows move the mean, every z-score changes
+	historyFeatures(endUser);
+	if(endUser->pool != NULL) endUser->memBytes = endUser->pool->reserved + columnsBytes(&(endUser->cols)) + dateIndexBytes(&(endUser->dates));
+	munmap((void*)buf, st.st_size);
+	
+	return added;
+}
+
+/* Follow mode (menu option 10) : polls the user's csv once a second and prints every appended transaction 
+* with the updated mean and standard deviation, until Enter is pressed.
+*/
+void followCsv(item *endUser) {
+	
+	char csvName[64];
+	snprintf(csvName, sizeof(csvName), "%s.csv", endUser->client.name);
+	
+	int c;
+	while((c = getchar()) != '\n' && c != EOF);	// rest of the menu input
+	
+	printf(CYAN "\nFollowing %s, press Enter to stop\n", csvName);
+	
+	while(1) {
+		
+		node *last = endUser->list.end;
+		long added = appendCsvRows(endUser, csvName);
+		
+		if(added == -1) {
+			printf(RED "%s was truncated or could not be read, log in again to reload it\n", csvName);
+			break;
+		}
+		
+		if(added > 0) {
+			
+			node *temp = (last == NULL) ? endUser->list.head : last->next;
+			
+			while(temp != NULL) {
+				printf("New transaction : \n");
+				printf("%d/%d/%d at %s at %d:%d:%d \n", temp->date_of_payment.day, temp->date_of_payment.month, temp->date_of_payment.year, locationName(temp->payment_place.city), temp->time_of_payment.tm_hour, temp->time_of_payment.tm_min, temp->time_of_payment.tm_sec );
+				printf("Amount %f \n", temp->amount);
+				
+				if(temp->status == 'S' || temp->status == 's') 
+					printf(" Status : Successful \n");
+				
+				else 
+					printf(" Status : Failed\n");
+				
+				printf("----------------------------------------- \n");
+				temp = temp->next;
+			}
+			
+			printf(CYAN "Mean : %f  Standard Deviation : %f \n", endUser->mean, endUser->stdDev);
+		}
+		
+		fd_set in;
+		FD_ZERO(&in);
+		FD_SET(STDIN_FILENO, &in);
+		struct timeval wait = {1, 0};
+		
+		if(select(STDIN_FILENO + 1, &in, NULL, NULL, &wait) > 0) {
+			while((c = getchar()) != '\n' && c != EOF);
+			break;
+		}
+	}
+}
+
+/* String dictionary (string -> dense id 0, 1, 2 ...), open addressing over an FNV-1a hash.
+* Lookups take the read lock, only a string seen for the first time takes the write lock.
+*/
+static unsigned int strHash(const char *str, int len) {
+	
+	unsigned int h = 2166136261u;
+	
+	for(int i = 0; i < len; i++) {
+		h ^= (unsigned char)str[i];
+		h *= 16777619u;
+	}
+	
+	return h;
+}
+
+static int dictProbe(strDict *d, const char *str, int len, unsigned int *slot) {
+	
+	unsigned int k = strHash(str, len) & (d->slotCap - 1);
+	
+	while(d->slots[k] != 0) {
+		const char *name = dictName(d, d->slots[k] - 1);
+		if(strncmp(name, str, len) == 0 && name[len] == '\0') return d->slots[k] - 1;
+		k = (k + 1) & (d->slotCap - 1);
+	}
+	
+	*slot = k;
+	return -1;
+}
+
+static void dictGrow(strDict *d) {
+	
+	int slotCap = (d->slotCap == 0) ? 64 : d->slotCap * 2;
+	int *slots = (int*)calloc(slotCap, sizeof(int));
+	
+	for(int id = 0; id < d->count; id++) {
+		const char *name = dictName(d, id);
+		unsigned int k = strHash(name, strlen(name)) & (slotCap - 1);
+		while(slots[k] != 0) k = (k + 1) & (slotCap - 1);
+		slots[k] = id + 1;
+	}
+	
+	free(d->slots);
+	d->slots = slots;
+	d->slotCap = slotCap;
+}
+
+const char *dictName(strDict *d, int id) {
+	
+	if(id < 0 || id >= DICT_PAGE * DICT_PAGES || d->pages[id / DICT_PAGE] == NULL) return "?";
+	
+	return d->pages[id / DICT_PAGE][id % DICT_PAGE];
+}
+
+// Returns the id of the first len characters of str, or -1 if they were never interned.
+
+int dictLookup(strDict *d, const char *str, int len) {
+	
+	unsigned int slot;
+	int id = -1;
+	
+	if(len > DICT_NAME - 1) len = DICT_NAME - 1;
+	
+	pthread_rwlock_rdlock(&d->lock);
+	if(d->slotCap != 0) id = dictProbe(d, str, len, &slot);
+	pthread_rwlock_unlock(&d->lock);
+	
+	return id;
+}
+
+// Returns the id of the first len characters of str, adding them if needed (-1 once the table is full).
+
+int dictIntern(strDict *d, const char *str, int len) {
+	
+	if(len > DICT_NAME - 1) len = DICT_NAME - 1;
+	
+	int id = dictLookup(d, str, len);
+	if(id != -1) return id;
+	
+	unsigned int slot;
+	
+	pthread_rwlock_wrlock(&d->lock);
+	
+	if(d->slotCap == 0 || 2 * (d->count + 1) > d->slotCap) dictGrow(d);
+	
+	id = dictProbe(d, str, len, &slot);	// another thread may have added it in between
+	
+	if(id == -1 && d->count < DICT_PAGE * DICT_PAGES) {
+		
+		id = d->count;
+		
+		if(d->pages[id / DICT_PAGE] == NULL) {
+			d->pages[id / DICT_PAGE] = (char(*)[DICT_NAME])calloc(DICT_PAGE, DICT_NAME);
+		}
+		
+		char *name = d->pages[id / DICT_PAGE][id % DICT_PAGE];
+		memcpy(name, str, len);
+		name[len] = '\0';
+		
+		d->slots[slot] = id + 1;
+		d->count++;
+	}
+	
+	pthread_rwlock_unlock(&d->lock);
+	
+	return id;
+}
+
+/* The location table : every city, state and country name seen in a transaction, shared by all users. 
+* Nodes, BST nodes and the columns store these ids, so comparing two places is comparing ints.
+*/
+static strDict locations = {.lock = PTHREAD_RWLOCK_INITIALIZER};
+
+int internLocation(const char *str, const char *end) {
+	return dictIntern(&locations, str, end - str);
+}
+
+int findLocation(const char *str) {
+	return dictLookup(&locations, str, strlen(str));
+}
+
+const char *locationName(int id) {
+	return dictName(&locations, id);
+}
+
+// The ids of a place typed by the user or read from users.csv, without adding anything to the table.
+
+locId findPlace(location place) {
+	
+	locId ids;
+	ids.city = findLocation(place.city);
+	ids.state = findLocation(place.state);
+	ids.country = findLocation(place.country);
+	
+	return ids;
+}
+
+int locationCount(void) {
+	
+	pthread_rwlock_rdlock(&locations.lock);
+	int count = locations.count;
+	pthread_rwlock_unlock(&locations.lock);
+	
+	return count;
+}
+
+/* Columnar (structure of arrays) copy of a history : one contiguous array per field the scans need 
+* (amount, epoch, status, interned country and state ids, fraud flag), plus row[i], the list node of transaction i, 
+* for the fields that are only printed. A scan over amounts touches 4 bytes per transaction instead of a whole node.
+*/
+static void columnsReserve(txColumns *cols, long capacity) {
+	
+	if(capacity <= cols->capacity) return;
+	
+	if(capacity < 2 * cols->capacity) capacity = 2 * cols->capacity;
+	if(capacity < 64) capacity = 64;
+	
+	cols->amount = (float*)realloc(cols->amount, sizeof(float) * capacity);
+	cols->epoch = (long long*)realloc(cols->epoch, sizeof(long long) * capacity);
+	cols->hour = (unsigned char*)realloc(cols->hour, capacity);
+	cols->status = (char*)realloc(cols->status, capacity);
+	cols->country = (int*)realloc(cols->country, sizeof(int) * capacity);
+	cols->state = (int*)realloc(cols->state, sizeof(int) * capacity);
+	cols->zipSlot = (int*)realloc(cols->zipSlot, sizeof(int) * capacity);
+	cols->fraud = (unsigned char*)realloc(cols->fraud, capacity);
+	cols->row = (node**)realloc(cols->row, sizeof(node*) * capacity);
+	cols->capacity = capacity;
+}
+
+/* Appends one transaction to the columns.
+* Time Complexity : amortized O(1).
+*/
+void columnsAppend(txColumns *cols, node *newNode) {
+	
+	columnsReserve(cols, cols->count + 1);
+	
+	long i = cols->count++;
+	cols->amount[i] = newNode->amount;
+	cols->epoch[i] = newNode->epoch;
+	cols->hour[i] = epochHour(newNode->epoch);
+	cols->status[i] = newNode->status;
+	cols->country[i] = newNode->payment_place.country;
+	cols->state[i] = newNode->payment_place.state;
+	cols->zipSlot[i] = zipSlot(newNode->zipCode);
+	cols->fraud[i] = 0;
+	cols->row[i] = newNode;
+	
+	rollup delta = {1, newNode->amount, (double)newNode->amount * newNode->amount, (newNode->status == 'f' || newNode->status == 'F'), 0};
+	rollupAdd(&(cols->days), dayNumber(newNode->date_of_payment), delta);
+	rollupAdd(&(cols->months), monthNumber(newNode->date_of_payment), delta);
+	
+	// posted under the place, its state and its country, so every kind of location query is a single lookup
+	locId place = newNode->payment_place;
+	placeIndexAdd(&(cols->places), place, i);
+	place.city = LOC_ANY;
+	placeIndexAdd(&(cols->places), place, i);
+	place.state = LOC_ANY;
+	placeIndexAdd(&(cols->places), place, i);
+}
+
+/* Builds the columns of a loaded history from its list.
+* Time Complexity : O(N).
+*/
+void buildColumns(txColumns *cols, dll list, long count) {
+	
+	columnsReserve(cols, count);
+	
+	for(node *temp = list.head; temp != NULL; temp = temp->next) {
+		columnsAppend(cols, temp);
+	}
+}
+
+void freeColumns(txColumns *cols) {
+	
+	free(cols->amount);
+	free(cols->epoch);
+	free(cols->hour);
+	free(cols->status);
+	free(cols->country);
+	free(cols->state);
+	free(cols->zipSlot);
+	free(cols->fraud);
+	free(cols->row);
+	freePlaceIndex(&(cols->places));
+	freeRollups(&(cols->days));
+	freeRollups(&(cols->months));
+	memset(cols, 0, sizeof(*cols));
+}
+
+long columnsBytes(txColumns *cols) {
+	return cols->capacity * (long)(sizeof(float) + sizeof(long long) + 1 + 1 + 3 * sizeof(int) + 1 + sizeof(node*)) + cols->places.bytes + (cols->days.capacity + cols->months.capacity) * (long)sizeof(rollup);
+}
+
+/* Window of the spending profile, set once at start up (--window-tx N or --window-days N). 
+* With neither, z-scores use the all-time mean and standard deviation as before.
+*/
+static long windowTransactions = 0;
+static long long windowSeconds = 0;
+
+void setProfileWindow(long transactions, long days) {
+	
+	windowTransactions = (transactions > 0) ? transactions : 0;
+	windowSeconds = (days > 0) ? days * 86400LL : 0;
+}
+
+int profileEnabled(void) {
+	return windowTransactions > 0 || windowSeconds > 0;
+}
+
+static void profileEvict(spendProfile *p) {
+	
+	long long u = p->units[p->head];
+	
+	p->sum -= u;
+	p->sumSq -= (__int128)u * u;
+	p->head = (p->head + 1) % p->capacity;
+	p->count--;
+}
+
+/* Adds one successful amount at epoch; with a transaction window the oldest one is evicted once the window is full.
+* Time Complexity : O(1) (amortized, the buffer of a day window doubles when it is full).
+*/
+void profilePush(spendProfile *p, float amount, long long epoch) {
+	
+	if(windowTransactions > 0 && p->count == windowTransactions) profileEvict(p);
+	
+	if(p->count == p->capacity) {
+		
+		long capacity = (p->capacity == 0) ? 64 : p->capacity * 2;
+		if(windowTransactions > 0 && capacity > windowTransactions) capacity = windowTransactions;
+		
+		long long *units = (long long*)malloc(sizeof(long long) * capacity);
+		long long *epochs = (long long*)malloc(sizeof(long long) * capacity);
+		
+		for(long i = 0; i < p->count; i++) {	// unrolls the ring so that head is 0 again
+			units[i] = p->units[(p->head + i) % p->capacity];
+			epochs[i] = p->epoch[(p->head + i) % p->capacity];
+		}
+		
+		free(p->units);
+		free(p->epoch);
+		p->units = units;
+		p->epoch = epochs;
+		p->capacity = capacity;
+		p->head = 0;
+	}
+	
+	long long u = llround((double)amount * 10000.0);
+	long tail = (p->head + p->count) % p->capacity;
+	
+	p->units[tail] = u;
+	p->epoch[tail] = epoch;
+	p->sum += u;
+	p->sumSq += (__int128)u * u;
+	p->count++;
+}
+
+// With a day window, evicts the amounts older than the window ending at now.
+
+void profileExpire(spendProfile *p, long long now) {
+	
+	while(windowSeconds > 0 && p->count > 0 && p->epoch[p->head] < now - windowSeconds) {
+		profileEvict(p);
+	}
+}
+
+/* Mean and population standard deviation of the window, returns the number of amounts in it.
+* The variance numerator n * Σu² - (Σu)² is computed exactly in 128 bit integers.
+*/
+long profileStats(const spendProfile *p, double *mean, double *stdDev) {
+	
+	if(p->count == 0) {
+		*mean = 0.0;
+		*stdDev = 0.0;
+		return 0;
+	}
+	
+	__int128 num = p->sumSq * p->count - (__int128)p->sum * p->sum;
+	
+	*mean = (double)p->sum / p->count / 10000.0;
+	*stdDev = sqrt((double)num) / p->count / 10000.0;
+	
+	return p->count;
+}
+
+void freeProfile(spendProfile *p) {
+	
+	free(p->units);
+	free(p->epoch);
+	memset(p, 0, sizeof(*p));
+}
+
+/* Builds the live profile of a loaded history : the window ending at its latest transaction.
+* Time Complexity : O(N).
+*/
+void buildProfile(item *endUser) {
+	
+	txColumns *cols = &(endUser->cols);
+	
+	freeProfile(&(endUser->profile));
+	if(!profileEnabled()) return;
+	
+	for(long i = 0; i < cols->count; i++) {
+		if(cols->status[i] == 'S' || cols->status[i] == 's') {
+			profileExpire(&(endUser->profile), cols->epoch[i]);
+			profilePush(&(endUser->profile), cols->amount[i], cols->epoch[i]);
+		}
+	}
+	
+	if(cols->count > 0) profileExpire(&(endUser->profile), cols->epoch[cols->count - 1]);
+}
+
+static float profileZ(const spendProfile *p, float amount, item *endUser) {
+	
+	double mean, stdDev;
+	
+	if(profileStats(p, &mean, &stdDev) < 2 || stdDev == 0.0) {
+		return (amount - endUser->mean)/(endUser->stdDev);	// too little in the window yet, the all-time figures
+	}
+	
+	return (float)((amount - mean) / stdDev);
+}
+
+/* z-score of every transaction of the history, in column order. Without a window this is (amount - mean) / stdDev 
+* over the all-time figures; with one, each transaction is scored against the window of successful transactions 
+* before it, so the score follows the drift of the user's spending.
+* Time Complexity : O(N). The caller frees the array.
+*/
+float *historyZScores(item *endUser) {
+	
+	txColumns *cols = &(endUser->cols);
+	float *z = (float*)malloc(sizeof(float) * (cols->count > 0 ? cols->count : 1));
+	
+	if(!profileEnabled()) {
+		for(long i = 0; i < cols->count; i++) {
+			z[i] = (cols->amount[i] - endUser->mean)/(endUser->stdDev);
+		}
+		return z;
+	}
+	
+	spendProfile window;
+	memset(&window, 0, sizeof(window));
+	
+	for(long i = 0; i < cols->count; i++) {
+		
+		profileExpire(&window, cols->epoch[i]);
+		z[i] = profileZ(&window, cols->amount[i], endUser);
+		
+		if(cols->status[i] == 'S' || cols->status[i] == 's') {
+			profilePush(&window, cols->amount[i], cols->epoch[i]);
+		}
+	}
+	
+	freeProfile(&window);
+	
+	return z;
+}
+
+/* The rule set. Defaults are the thresholds the rules always used; loadRuleConfig replaces them from a 
+* "key = value" file and compileRules folds the hour rules into one table, so the kernels and the scans 
+* only look up and compare, whatever the configuration.
+*/
+static ruleConfig rules = {3.0f, 1.5f, 3.0f, 6, 22, 6, 16, 300, 3, 3, 1000.0f, 100.0f, 
+			   RULE_OUTLIER | RULE_ODD | RULE_FAILED | RULE_FREQUENT | RULE_LOCATION | RULE_TRAVEL, "India", {0}};
+
+static void compileRules(ruleConfig *r) {
+	
+	for(int h = 0; h < 24; h++) {
+		
+		int odd = (h < r->oddBefore || h > r->oddAfter);
+		int part = odd ? PART_ODD : (h > r->dayAfter && h < r->dayBefore) ? PART_DAY : PART_EVENING;
+		
+		r->hourFlags[h] = (odd ? FEAT_ODD : 0) | (part << FEAT_PART_SHIFT);
+	}
+}
+
+static pthread_once_t rulesCompiled = PTHREAD_ONCE_INIT;
+
+static void compileDefaultRules() {
+	compileRules(&rules);
+}
+
+const ruleConfig *ruleSettings() {
+	
+	pthread_once(&rulesCompiled, compileDefaultRules);
+	
+	return &rules;
+}
+
+static int ruleBit(const char *name) {
+	
+	if(strcmp(name, "outlier") == 0) return RULE_OUTLIER;
+	if(strcmp(name, "odd_hour") == 0) return RULE_ODD;
+	if(strcmp(name, "failed") == 0) return RULE_FAILED;
+	if(strcmp(name, "frequent") == 0) return RULE_FREQUENT;
+	if(strcmp(name, "location") == 0) return RULE_LOCATION;
+	if(strcmp(name, "travel") == 0) return RULE_TRAVEL;
+	
+	return -1;
+}
+
+/* Reads the rule set from path : one "key = value" per line, # starts a comment. A key that is not set keeps its 
+* default and a line that cannot be used is reported and skipped, so a bad edit never leaves the rules half set.
+* Keys : outlier_z, bucket_low, bucket_high, odd_before, odd_after, day_after, day_before, burst_seconds, 
+* failed_run, frequent_run, max_speed_kmh, min_travel_km, home_country and rules (the names of the rules in use).
+* Returns -1 if the file cannot be opened, otherwise the number of lines skipped.
+*/
+int loadRuleConfig(const char *path) {
+	
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL) return -1;
+	
+	ruleConfig r = *ruleSettings();
+	char line[256];
+	int lineNo = 0;
+	int skipped = 0;
+	
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		
+		lineNo++;
+		
+		char *hash = strchr(line, '#');
+		if(hash != NULL) *hash = '\0';
+		
+		char key[32], value[200];
+		
+		if(sscanf(line, " %31[a-z_] = %199[^\n]", key, value) != 2) {
+			if(strspn(line, " \t\r\n") != strlen(line)) {
+				printf(YELLOW "%s:%d : expected key = value\n" RESET, path, lineNo);
+				skipped++;
+			}
+			continue;
+		}
+		
+		for(int k = strlen(value) - 1; k >= 0 && isspace((unsigned char)value[k]); k--) value[k] = '\0';
+		
+		char *end;
+		double number = strtod(value, &end);
+		int isNumber = (end != value && *end == '\0');
+		int ok = 1;
+		
+		if(strcmp(key, "outlier_z") == 0 && isNumber && number > 0) r.outlierZ = number;
+		else if(strcmp(key, "bucket_low") == 0 && isNumber && number > 0) r.bucketLow = number;
+		else if(strcmp(key, "bucket_high") == 0 && isNumber && number > 0) r.bucketHigh = number;
+		else if(strcmp(key, "odd_before") == 0 && isNumber && number >= 0 && number <= 24) r.oddBefore = number;
+		else if(strcmp(key, "odd_after") == 0 && isNumber && number >= -1 && number <= 23) r.oddAfter = number;
+		else if(strcmp(key, "day_after") == 0 && isNumber && number >= -1 && number <= 23) r.dayAfter = number;
+		else if(strcmp(key, "day_before") == 0 && isNumber && number >= 0 && number <= 24) r.dayBefore = number;
+		else if(strcmp(key, "burst_seconds") == 0 && isNumber && number >= 0) r.burstSeconds = number;
+		else if(strcmp(key, "failed_run") == 0 && isNumber && number >= 1) r.failedRun = number;
+		else if(strcmp(key, "frequent_run") == 0 && isNumber && number >= 1) r.frequentRun = number;
+		else if(strcmp(key, "max_speed_kmh") == 0 && isNumber && number > 0) r.maxSpeed = number;
+		else if(strcmp(key, "min_travel_km") == 0 && isNumber && number >= 0) r.minTravel = number;
+		else if(strcmp(key, "home_country") == 0 && strlen(value) < sizeof(r.homeCountry)) strcpy(r.homeCountry, value);
+		else if(strcmp(key, "rules") == 0) {
+			
+			int enabled = 0;
+			
+			for(char *name = strtok(value, " ,\t"); name != NULL && ok; name = strtok(NULL, " ,\t")) {
+				int bit = ruleBit(name);
+				if(bit < 0) ok = 0;
+				enabled |= bit;
+			}
+			
+			if(ok) r.enabled = enabled;
+		}
+		else ok = 0;
+		
+		if(!ok) {
+			printf(YELLOW "%s:%d : cannot use %s\n" RESET, path, lineNo, key);
+			skipped++;
+		}
+	}
+	
+	fclose(fp);
+	
+	if(r.bucketLow > r.bucketHigh) {
+		printf(YELLOW "%s : bucket_low is above bucket_high, keeping %g and %g\n" RESET, path, rules.bucketLow, rules.bucketHigh);
+		r.bucketLow = rules.bucketLow;
+		r.bucketHigh = rules.bucketHigh;
+		skipped++;
+	}
+	
+	compileRules(&r);
+	rules = r;
+	
+	return skipped;
+}
+
+/* Feature kernels : z = (amount - mean) / stdDev (unless the z-scores are given) and the packed feature byte, 
+* over the contiguous amount and hour columns, with the thresholds of the rule set. Every variant computes exactly 
+* the scalar results (the same float subtraction and division, the same comparisons, the same hour table).
+*/
+static unsigned char featureByte(const ruleConfig *r, float z, int hour) {
+	
+	float a = fabsf(z);
+	unsigned char f = (a <= r->bucketLow) ? 0 : (a <= r->bucketHigh) ? 1 : 2;
+	
+	if(a >= r->outlierZ) f |= FEAT_OUTLIER;
+	
+	return f | r->hourFlags[hour];
+}
+
+static void featuresScalar(const float *amount, const unsigned char *hour, long n, float mean, float stdDev, int computeZ, float *z, unsigned char *flags) {
+	
+	const ruleConfig *r = ruleSettings();
+	
+	for(long i = 0; i < n; i++) {
+		if(computeZ) z[i] = (amount[i] - mean)/(stdDev);
+		flags[i] = featureByte(r, z[i], hour[i]);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* The hour bits of 16 hours (0 to 23) with two byte shuffles over the compiled hour table.
+*/
+__attribute__((target("avx2")))
+static inline __m128i hourLookup(__m128i h, __m128i lowTable, __m128i highTable) {
+	
+	__m128i high = _mm_cmpgt_epi8(h, _mm_set1_epi8(15));
+	
+	return _mm_blendv_epi8(_mm_shuffle_epi8(lowTable, h), _mm_shuffle_epi8(highTable, h), high);
+}
+
+__attribute__((target("avx2")))
+static void featuresAVX2(const float *amount, const unsigned char *hour, long n, float mean, float stdDev, int computeZ, float *z, unsigned char *flags) {
+	
+	const ruleConfig *r = ruleSettings();
+	unsigned char high[16] = {0};
+	memcpy(high, r->hourFlags + 16, 8);
+	
+	const __m128i lowTable = _mm_loadu_si128((const __m128i*)r->hourFlags);
+	const __m128i highTable = _mm_loadu_si128((const __m128i*)high);
+	const __m256 vmean = _mm256_set1_ps(mean);
+	const __m256 vstd = _mm256_set1_ps(stdDev);
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	const __m256 limLow = _mm256_set1_ps(r->bucketLow);
+	const __m256 limHigh = _mm256_set1_ps(r->bucketHigh);
+	const __m256 limOutlier = _mm256_set1_ps(r->outlierZ);
+	const __m256i two = _mm256_set1_epi32(2);
+	const __m256i outlier = _mm256_set1_epi32(FEAT_OUTLIER);
+	const __m256i lowBytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 
+						  0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i joinLanes = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+	long i = 0;
+	
+	for(; i + 8 <= n; i += 8) {
+		
+		__m256 v;
+		
+		if(computeZ) {
+			v = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(amount + i), vmean), vstd);
+			_mm256_storeu_ps(z + i, v);
+		}
+		else {
+			v = _mm256_loadu_ps(z + i);
+		}
+		
+		__m256 a = _mm256_andnot_ps(sign, v);
+		__m256i leLow = _mm256_castps_si256(_mm256_cmp_ps(a, limLow, _CMP_LE_OQ));
+		__m256i leHigh = _mm256_castps_si256(_mm256_cmp_ps(a, limHigh, _CMP_LE_OQ));
+		__m256i geOutlier = _mm256_castps_si256(_mm256_cmp_ps(a, limOutlier, _CMP_GE_OQ));
+		__m256i f = _mm256_add_epi32(two, _mm256_add_epi32(leLow, leHigh));	// masks are -1 : 2, 1 or 0
+		f = _mm256_or_si256(f, _mm256_and_si256(geOutlier, outlier));
+		
+		__m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(f, lowBytes), joinLanes);
+		__m128i h = _mm_loadl_epi64((const __m128i*)(hour + i));
+		__m128i bytes = _mm_or_si128(_mm256_castsi256_si128(packed), hourLookup(h, lowTable, highTable));
+		
+		_mm_storel_epi64((__m128i*)(flags + i), bytes);
+	}
+	
+	featuresScalar(amount + i, hour + i, n - i, mean, stdDev, computeZ, z + i, flags + i);
+}
+
+__attribute__((target("avx2,avx512f,avx512bw")))
+static void featuresAVX512(const float *amount, const unsigned char *hour, long n, float mean, float stdDev, int computeZ, float *z, unsigned char *flags) {
+	
+	const ruleConfig *r = ruleSettings();
+	unsigned char high[16] = {0};
+	memcpy(high, r->hourFlags + 16, 8);
+	
+	const __m128i lowTable = _mm_loadu_si128((const __m128i*)r->hourFlags);
+	const __m128i highTable = _mm_loadu_si128((const __m128i*)high);
+	const __m512 vmean = _mm512_set1_ps(mean);
+	const __m512 vstd = _mm512_set1_ps(stdDev);
+	const __m512 limLow = _mm512_set1_ps(r->bucketLow);
+	const __m512 limHigh = _mm512_set1_ps(r->bucketHigh);
+	const __m512 limOutlier = _mm512_set1_ps(r->outlierZ);
+	const __m512i one = _mm512_set1_epi32(1);
+	const __m512i two = _mm512_set1_epi32(2);
+	long i = 0;
+	
+	for(; i + 16 <= n; i += 16) {
+		
+		__m512 v;
+		
+		if(computeZ) {
+			v = _mm512_div_ps(_mm512_sub_ps(_mm512_loadu_ps(amount + i), vmean), vstd);
+			_mm512_storeu_ps(z + i, v);
+		}
+		else {
+			v = _mm512_loadu_ps(z + i);
+		}
+		
+		__m512 a = _mm512_abs_ps(v);
+		__mmask16 leLow = _mm512_cmp_ps_mask(a, limLow, _CMP_LE_OQ);
+		__mmask16 leHigh = _mm512_cmp_ps_mask(a, limHigh, _CMP_LE_OQ);
+		__mmask16 geOutlier = _mm512_cmp_ps_mask(a, limOutlier, _CMP_GE_OQ);
+		
+		__m512i f = _mm512_mask_mov_epi32(two, leHigh, one);
+		f = _mm512_mask_mov_epi32(f, leLow, _mm512_setzero_si512());
+		f = _mm512_mask_or_epi32(f, geOutlier, f, _mm512_set1_epi32(FEAT_OUTLIER));
+		
+		__m128i h = _mm_loadu_si128((const __m128i*)(hour + i));
+		
+		_mm_storeu_si128((__m128i*)(flags + i), _mm_or_si128(_mm512_cvtepi32_epi8(f), hourLookup(h, lowTable, highTable)));
+	}
+	
+	featuresScalar(amount + i, hour + i, n - i, mean, stdDev, computeZ, z + i, flags + i);
+}
+
+#endif
+
+static int kernelLevel = KERNEL_BEST;
+
+// The kernel this cpu runs for a requested level : the level itself if it has it, otherwise the best it has below.
+
+static int supportedKernel(int level) {
+	
+#if defined(__x86_64__) || defined(__i386__)
+	if((level == KERNEL_BEST || level == KERNEL_AVX512) && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return KERNEL_AVX512;
+	if(level != KERNEL_SCALAR && __builtin_cpu_supports("avx2")) return KERNEL_AVX2;
+#endif
+
+	return KERNEL_SCALAR;
+}
+
+/* Forces the feature and travel kernels (KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512 or KERNEL_BEST).
+* Returns the level that will actually be used on this cpu.
+*/
+int setFeatureKernel(int level) {
+	
+	__atomic_store_n(&kernelLevel, level, __ATOMIC_RELAXED);
+	
+	return supportedKernel(level);
+}
+
+// The kernel level in use : the forced one if this cpu has it, otherwise the best it has.
+
+static int bestKernel() {
+	
+	return supportedKernel(__atomic_load_n(&kernelLevel, __ATOMIC_RELAXED));
+}
+
+static featureKernel currentKernel() {
+	
+	switch(bestKernel()) {
+#if defined(__x86_64__) || defined(__i386__)
+		case KERNEL_AVX512 : return featuresAVX512;
+		case KERNEL_AVX2 : return featuresAVX2;
+#endif
+		default : return featuresScalar;
+	}
+}
+
+/* Zip code table (zipcodes.csv : zipCode,latitude,longitude), loaded once at startup and read only after. 
+* Sorted by zip code for a binary search; every place is also kept as a unit vector (x, y, z) so the distance 
+* kernels need no trigonometry : the chord c between two unit vectors gives the haversine, hav(d / R) = c^2 / 4.
+* Slot count is the unknown place, NaN everywhere, so lookups and gathers never need a check.
+*/
+static float unknownPlace[1] = {NAN};
+static zipTable zips = {0, NULL, unknownPlace, unknownPlace, unknownPlace, unknownPlace, unknownPlace};
+
+typedef struct zipRow {
+	int zip;
+	float lat;
+	float lon;
+}zipRow;
+
+static int compareZipRows(const void *a, const void *b) {
+	
+	int x = ((const zipRow*)a)->zip, y = ((const zipRow*)b)->zip;
+	
+	return (x > y) - (x < y);
+}
+
+/* Loads the zip code table. Returns the number of zip codes, -1 if the file cannot be opened.
+* Time Complexity : O(Z log Z).
+*/
+int loadZipTable(const char *path) {
+	
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL) return -1;
+	
+	int capacity = 64, count = 0;
+	zipRow *rows = (zipRow*)malloc(sizeof(zipRow) * capacity);
+	char line[128];
+	
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		
+		zipRow r;
+		
+		if(sscanf(line, "%d,%f,%f", &r.zip, &r.lat, &r.lon) != 3) continue;	// header
+		
+		if(count == capacity) {
+			capacity *= 2;
+			rows = (zipRow*)realloc(rows, sizeof(zipRow) * capacity);
+		}
+		
+		rows[count++] = r;
+	}
+	
+	fclose(fp);
+	qsort(rows, count, sizeof(zipRow), compareZipRows);
+	
+	zipTable t;
+	t.count = count;
+	t.zip = (int*)malloc(sizeof(int) * (count + 1));
+	t.x = (float*)malloc(sizeof(float) * (count + 1));
+	t.y = (float*)malloc(sizeof(float) * (count + 1));
+	t.z = (float*)malloc(sizeof(float) * (count + 1));
+	t.lat = (float*)malloc(sizeof(float) * (count + 1));
+	t.lon = (float*)malloc(sizeof(float) * (count + 1));
+	
+	for(int k = 0; k < count; k++) {
+		
+		double lat = rows[k].lat * M_PI / 180.0, lon = rows[k].lon * M_PI / 180.0;
+		
+		t.zip[k] = rows[k].zip;
+		t.lat[k] = rows[k].lat;
+		t.lon[k] = rows[k].lon;
+		t.x[k] = cos(lat) * cos(lon);
+		t.y[k] = cos(lat) * sin(lon);
+		t.z[k] = sin(lat);
+	}
+	
+	t.zip[count] = -1;
+	t.x[count] = t.y[count] = t.z[count] = t.lat[count] = t.lon[count] = NAN;
+	free(rows);
+	
+	zips = t;
+	
+	return count;
+}
+
+// Slot of a zip code in the table, zips.count (the unknown place) if it is not there. O(log Z).
+
+int zipSlot(int zip) {
+	
+	int lo = 0, hi = zips.count;
+	
+	while(lo < hi) {
+		int mid = (lo + hi) / 2;
+		if(zips.zip[mid] < zip) lo = mid + 1;
+		else hi = mid;
+	}
+	
+	return (lo < zips.count && zips.zip[lo] == zip) ? lo : zips.count;
+}
+
+/* Travel kernels : chord[i] = |p(slot[i]) - p(slot[i - 1])| between the unit vectors of consecutive transactions, 
+* chord[0] = 0, NaN when either place is unknown. The vector versions gather the three coordinates of 8 or 16 
+* places at a time and compute exactly the scalar results (the same operations in the same order).
+*/
+static void travelScalar(const int *slot, long n, float *chord) {
+	
+	if(n > 0) chord[0] = 0.0f;
+	
+	for(long i = 1; i < n; i++) {
+		
+		float dx = zips.x[slot[i]] - zips.x[slot[i - 1]];
+		float dy = zips.y[slot[i]] - zips.y[slot[i - 1]];
+		float dz = zips.z[slot[i]] - zips.z[slot[i - 1]];
+		float dx2 = dx * dx, dy2 = dy * dy, dz2 = dz * dz;
+		
+		chord[i] = sqrtf(dx2 + dy2 + dz2);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2")))
+static void travelAVX2(const int *slot, long n, float *chord) {
+	
+	long i = 1;
+	
+	if(n > 0) chord[0] = 0.0f;
+	
+	for(; i + 8 <= n; i += 8) {
+		
+		__m256i cur = _mm256_loadu_si256((const __m256i*)(slot + i));
+		__m256i prev = _mm256_loadu_si256((const __m256i*)(slot + i - 1));
+		__m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(zips.x, cur, 4), _mm256_i32gather_ps(zips.x, prev, 4));
+		__m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(zips.y, cur, 4), _mm256_i32gather_ps(zips.y, prev, 4));
+		__m256 dz = _mm256_sub_ps(_mm256_i32gather_ps(zips.z, cur, 4), _mm256_i32gather_ps(zips.z, prev, 4));
+		__m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+		
+		_mm256_storeu_ps(chord + i, _mm256_sqrt_ps(sum));
+	}
+	
+	if(i < n) {
+		float first = chord[i - 1];
+		travelScalar(slot + i - 1, n - i + 1, chord + i - 1);	// from the previous row, whose chord it rewrites as 0
+		chord[i - 1] = first;
+	}
+}
+
+__attribute__((target("avx512f")))
+static void travelAVX512(const int *slot, long n, float *chord) {
+	
+	long i = 1;
+	
+	if(n > 0) chord[0] = 0.0f;
+	
+	for(; i + 16 <= n; i += 16) {
+		
+		__m512i cur = _mm512_loadu_si512((const void*)(slot + i));
+		__m512i prev = _mm512_loadu_si512((const void*)(slot + i - 1));
+		__m512 dx = _mm512_sub_ps(_mm512_i32gather_ps(cur, zips.x, 4), _mm512_i32gather_ps(prev, zips.x, 4));
+		__m512 dy = _mm512_sub_ps(_mm512_i32gather_ps(cur, zips.y, 4), _mm512_i32gather_ps(prev, zips.y, 4));
+		__m512 dz = _mm512_sub_ps(_mm512_i32gather_ps(cur, zips.z, 4), _mm512_i32gather_ps(prev, zips.z, 4));
+		__m512 sum = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)), _mm512_mul_ps(dz, dz));
+		
+		_mm512_storeu_ps(chord + i, _mm512_sqrt_ps(sum));
+	}
+	
+	if(i < n) {
+		float first = chord[i - 1];
+		travelScalar(slot + i - 1, n - i + 1, chord + i - 1);
+		chord[i - 1] = first;
+	}
+}
+
+#endif
+
+static travelKernel currentTravelKernel() {
+	
+	switch(bestKernel()) {
+#if defined(__x86_64__) || defined(__i386__)
+		case KERNEL_AVX512 : return travelAVX512;
+		case KERNEL_AVX2 : return travelAVX2;
+#endif
+		default : return travelScalar;
+	}
+}
+
+/* The impossible travel rule over a whole history : km[i] is the great circle distance from transaction i - 1 
+* (NaN when a zip code is not in the table), and transaction i gets FEAT_TRAVEL when covering it in the time 
+* between the two would take more than max_speed_kmh. Moves shorter than min_travel_km are never flagged : zip codes 
+* of one metro area are a few km apart, and two payments seconds apart between them would need any speed at all.
+* The chords come from the travel kernel; only the rows that moved need the arcsine, d = 2R asin(c / 2), 
+* consecutive payments at the same place cost nothing more.
+* Time Complexity : O(N).
+*/
+void travelRuns(const txColumns *cols, float *km, unsigned char *flags) {
+	
+	double maxSpeed = ruleSettings()->maxSpeed, minTravel = ruleSettings()->minTravel;
+	
+	currentTravelKernel()(cols->zipSlot, cols->count, km);
+	
+	for(long i = 1; i < cols->count; i++) {
+		
+		if(!(km[i] > 0.0f)) continue;	// same place or unknown
+		
+		double d = 2.0 * EARTH_RADIUS_KM * asin(fmin(1.0, km[i] / 2.0));
+		double hours = llabs(cols->epoch[i] - cols->epoch[i - 1]) / 3600.0;
+		
+		km[i] = d;
+		if(d >= minTravel && d > maxSpeed * hours) flags[i] |= FEAT_TRAVEL;
+	}
+}
+
+// Great circle distance in km between two zip slots with the haversine formula on latitude and longitude, NaN if either is unknown.
+
+double zipDistance(int a, int b) {
+	
+	double lat1 = zips.lat[a] * M_PI / 180.0, lat2 = zips.lat[b] * M_PI / 180.0;
+	double dlat = lat2 - lat1, dlon = (zips.lon[b] - zips.lon[a]) * M_PI / 180.0;
+	double h = sin(dlat / 2) * sin(dlat / 2) + cos(lat1) * cos(lat2) * sin(dlon / 2) * sin(dlon / 2);
+	
+	return 2.0 * EARTH_RADIUS_KM * asin(sqrt(h > 1.0 ? 1.0 : h));	// NaN stays NaN for an unknown place
+}
+
+/* Travel benchmark (./credit --bench-travel [n]) on n synthetic transactions between the places of the zip table : 
+* the haversine on latitude and longitude row by row against travelRuns with every kernel this cpu supports.
+*/
+void benchmarkTravel(long count) {
+	
+	if(zips.count < 2) {
+		printf(RED "The zip code table is not loaded (zipcodes.csv)\n" RESET);
+		return;
+	}
+	
+	txColumns cols;
+	memset(&cols, 0, sizeof(cols));
+	cols.count = count;
+	cols.epoch = (long long*)malloc(sizeof(long long) * count);
+	cols.zipSlot = (int*)malloc(sizeof(int) * count);
+	float *km = (float*)malloc(sizeof(float) * count);
+	unsigned char *flags = (unsigned char*)malloc(count);
+	unsigned char *fixed = (unsigned char*)malloc(count);
+	unsigned long long seed = 88172645463325252ULL;
+	long long t = 1500000000;
+	
+	if(cols.epoch == NULL || cols.zipSlot == NULL || km == NULL || flags == NULL || fixed == NULL) {
+		printf(RED "Not enough memory for %ld transactions\n" RESET, count);
+		count = 0;
+	}
+	
+	for(long i = 0; i < count; i++) {
+		seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+		t += (long long)((seed >> 16) % 20000);
+		cols.epoch[i] = t;
+		cols.zipSlot[i] = ((seed >> 40) % 4 == 0) ? (int)((seed >> 8) % (zips.count + 1)) : ((i > 0) ? cols.zipSlot[i - 1] : 0);
+	}
+	
+	double maxSpeed = ruleSettings()->maxSpeed, minTravel = ruleSettings()->minTravel;
+	double best = 1e30;
+	long flaggedFixed = 0;
+	
+	for(int round = 0; round < 3; round++) {
+		
+		double start = nowSeconds();
+		flaggedFixed = 0;
+		
+		for(long i = 0; i < count; i++) {
+			
+			fixed[i] = 0;
+			if(i == 0) continue;
+			
+			double d = zipDistance(cols.zipSlot[i - 1], cols.zipSlot[i]);
+			double hours = llabs(cols.epoch[i] - cols.epoch[i - 1]) / 3600.0;
+			
+			fixed[i] = (d >= minTravel && d > maxSpeed * hours);
+			flaggedFixed += fixed[i];
+		}
+		
+		double t1 = nowSeconds() - start;
+		if(t1 < best) best = t1;
+	}
+	
+	printf("%ld transactions, %d zip codes\n", count, zips.count);
+	printf("haversine row by row : %10.3f ms (%6.1f ns/tx), %ld flagged\n", best * 1000, best * 1e9 / count, flaggedFixed);
+	
+	const char *names[] = {"scalar", "AVX2", "AVX-512"};
+	int levels[] = {KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512};
+	
+	for(int k = 0; k < 3; k++) {
+		
+		if(setFeatureKernel(levels[k]) != levels[k]) {
+			printf("%-8s : not supported on this cpu\n", names[k]);
+			continue;
+		}
+		
+		best = 1e30;
+		long flagged = 0, mismatches = 0;
+		
+		for(int round = 0; round < 3; round++) {
+			
+			memset(flags, 0, count);
+			double start = nowSeconds();
+			travelRuns(&cols, km, flags);
+			double t1 = nowSeconds() - start;
+			if(t1 < best) best = t1;
+		}
+		
+		for(long i = 0; i < count; i++) {
+			flagged += (flags[i] & FEAT_TRAVEL) != 0;
+			mismatches += ((flags[i] & FEAT_TRAVEL) != 0) != fixed[i];
+		}
+		
+		printf("%-8s kernel      : %10.3f ms (%6.1f ns/tx), %ld flagged, %ld rows differ\n", names[k], best * 1000, best * 1e9 / count, flagged, mismatches);
+	}
+	
+	setFeatureKernel(KERNEL_BEST);
+	
+	free(cols.epoch); free(cols.zipSlot); free(km); free(flags); free(fixed);
+}
+
+/* The impossible travel rule against the haversine distance row by row, on synthetic rows that visit every pair of 
+* places of the zip code table (and an unknown one) at gaps from 0 seconds to a day. Run with the configured limits 
+* and with a walking speed, with and without a minimum distance, on every travel kernel this cpu supports. 
+* The configured limits are restored afterwards.
+*/
+static int checkTravel(void) {
+	
+	if(zips.count < 2) return 1;	// no table, the rule never fires
+	
+	int places = zips.count + 1;	// the last slot is the unknown place
+	long long gaps[5] = {0, 10, 600, 3 * 3600, 86400};
+	txColumns cols;
+	memset(&cols, 0, sizeof(cols));
+	cols.count = (long)places * places * 2;
+	cols.epoch = (long long*)malloc(sizeof(long long) * cols.count);
+	cols.zipSlot = (int*)malloc(sizeof(int) * cols.count);
+	float *km = (float*)malloc(sizeof(float) * cols.count);
+	unsigned char *flags = (unsigned char*)malloc(cols.count);
+	long long t = 1500000000;
+	long i = 0;
+	
+	for(int a = 0; a < places; a++) {
+		for(int b = 0; b < places; b++) {
+			cols.zipSlot[i] = a;
+			cols.epoch[i++] = (t += 100000);
+			cols.zipSlot[i] = b;
+			cols.epoch[i++] = (t += gaps[(a + b) % 5]);
+		}
+	}
+	
+	const char *confName = "selftest_travel.conf";
+	ruleConfig saved = *ruleSettings();
+	float limits[4][2] = {{saved.maxSpeed, saved.minTravel}, {5.0f, 0.0f}, {5.0f, 100.0f}, {saved.maxSpeed, saved.minTravel}};
+	int ok = 1;
+	
+	for(int k = 0; k < 4; k++) {	// the last round only puts the saved limits back
+		
+		float speed = limits[k][0], minKm = limits[k][1];
+		FILE *fp = fopen(confName, "w");
+		
+		if(fp != NULL) {
+			fprintf(fp, "max_speed_kmh = %.9g\nmin_travel_km = %.9g\n", speed, minKm);
+			fclose(fp);
+		}
+		
+		ok = loadRuleConfig(confName) == 0 && ok;
+		if(k == 3 || !ok) continue;
+		
+		int levels[] = {KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512};
+		
+		for(int level = 0; level < 3 && ok; level++) {
+			
+			if(setFeatureKernel(levels[level]) != levels[level]) continue;
+			
+			memset(flags, 0, cols.count);
+			travelRuns(&cols, km, flags);
+			
+			for(i = 1; i < cols.count && ok; i++) {
+				
+				double d = zipDistance(cols.zipSlot[i - 1], cols.zipSlot[i]);
+				double hours = llabs(cols.epoch[i] - cols.epoch[i - 1]) / 3600.0;
+				int expected = d >= minKm && d > speed * hours;	// an unknown zip code (NaN) is never flagged
+				
+				ok = ((flags[i] & FEAT_TRAVEL) != 0) == expected;
+			}
+		}
+		
+		setFeatureKernel(KERNEL_BEST);
+	}
+	
+	remove(confName);
+	ok = ok && memcmp(ruleSettings(), &saved, sizeof(ruleConfig)) == 0;
+	
+	free(cols.epoch);
+	free(cols.zipSlot);
+	free(km);
+	free(flags);
+	return ok;
+}
+
+
+static void tallyRules(txColumns *cols, const txFeatures *f, countAmt *amt_cat, countLoc *loc_cat, countTime *time_cat, countStatus *st_cat);
+
+/* The rule stage : the verdict of every rule for every transaction, from the feature bytes and the runs.
+* Each rule is one bit taken without a branch and the rules that are not in use are masked out; the location 
+* rule, the only one that still compares columns, is skipped when it is off. Returns the number flagged.
+* Time Complexity : O(N).
+*/
+static long evaluateRules(txColumns *cols, const unsigned char *flags, const int *burst, unsigned char *verdict, int homeCountry, int homeState) {
+	
+	const ruleConfig *r = ruleSettings();
+	int enabled = r->enabled;
+	int frequentRun = r->frequentRun;
+	int location = (enabled & RULE_LOCATION) != 0;
+	long flagged = 0;
+	
+	for(long i = 0; i < cols->count; i++) {
+		
+		unsigned char v = (((flags[i] & FEAT_OUTLIER) != 0) * RULE_OUTLIER) 
+				| (((flags[i] & FEAT_ODD) != 0) * RULE_ODD) 
+				| (((flags[i] & FEAT_FAILED_RUN) != 0) * RULE_FAILED) 
+				| ((burst[i] >= frequentRun) * RULE_FREQUENT) 
+				| (((flags[i] & FEAT_TRAVEL) != 0) * RULE_TRAVEL);
+		
+		if(location && i > 0) {	// locationAnomalyAt without its branches
+			int sameCountry = (cols->country[i] == cols->country[i - 1]) & (cols->country[i] == homeCountry);
+			int sameState = (cols->state[i] == cols->state[i - 1]) & (cols->state[i] == homeState);
+			v |= !(sameCountry | sameState) * RULE_LOCATION;
+		}
+		
+		verdict[i] = v & enabled;
+		flagged += (verdict[i] != 0);
+	}
+	
+	return flagged;
+}
+
+/* Rule benchmark (./credit --bench-rules [n] [config]) on n synthetic transactions : the fixed rules of fraudAlert 
+* evaluated row by row (as before the rule set) against the compiled rule stage (feature kernel, ruleRuns and 
+* evaluateRules). With the default rules both must flag the same rows.
+*/
+void benchmarkRules(long count) {
+	
+	txColumns cols;
+	memset(&cols, 0, sizeof(cols));
+	cols.count = count;
+	cols.amount = (float*)malloc(sizeof(float) * count);
+	cols.epoch = (long long*)malloc(sizeof(long long) * count);
+	cols.hour = (unsigned char*)malloc(count);
+	cols.status = (char*)malloc(count);
+	cols.country = (int*)malloc(sizeof(int) * count);
+	cols.state = (int*)malloc(sizeof(int) * count);
+	float *z = (float*)malloc(sizeof(float) * count);
+	unsigned char *flags = (unsigned char*)malloc(count);
+	int *burst = (int*)malloc(sizeof(int) * count);
+	unsigned char *verdict = (unsigned char*)malloc(count);
+	unsigned char *fixed = (unsigned char*)malloc(count);
+	unsigned long long seed = 88172645463325252ULL;
+	long long t = 1500000000;
+	
+	if(cols.amount == NULL || cols.epoch == NULL || cols.hour == NULL || cols.status == NULL || cols.country == NULL || 
+	   cols.state == NULL || z == NULL || flags == NULL || burst == NULL || verdict == NULL || fixed == NULL) {
+		printf(RED "Not enough memory for %ld transactions\n" RESET, count);
+		count = 0;
+	}
+	
+	for(long i = 0; i < count; i++) {
+		seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+		cols.amount[i] = (float)(seed % 500000) / 100.0f + ((seed >> 40) % 200 == 0 ? 40000.0f : 0.0f);
+		t += (seed >> 20) % 4 == 0 ? (long long)((seed >> 24) % 240) : (long long)((seed >> 24) % 40000);
+		cols.epoch[i] = t;
+		cols.hour[i] = epochHour(t);
+		cols.status[i] = ((seed >> 32) % 10 < 2) ? 'F' : 'S';
+		cols.country[i] = ((seed >> 36) % 50 == 0) ? 2 : 1;
+		cols.state[i] = ((seed >> 44) % 30 == 0) ? 4 : 3;
+	}
+	
+	float mean = 2500.0f, stdDev = 1800.0f;
+	long flagged = 0, flaggedFixed = 0;
+	double rowByRow = 1e30, compiled = 1e30;
+	
+	for(int round = 0; round < 5; round++) {
+		
+		double start = nowSeconds();
+		flaggedFixed = 0;
+		
+		for(long i = 0; i < count; i++) {
+			
+			float zscore = (cols.amount[i] - mean)/(stdDev);
+			int hour = epochHour(cols.epoch[i]);
+			int isodd = (hour < 6 || hour > 22);
+			long failed = 0;
+			int frequent = 0;
+			
+			for(long j = i; j < count && (cols.status[j] == 'f' || cols.status[j] == 'F'); j++) failed++;
+			
+			for(long j = i + 1; j < count && llabs(cols.epoch[j] - cols.epoch[j - 1]) < 300; j++) frequent++;
+			
+			int diff_loc = (i > 0) ? locationAnomalyAt(&cols, i, 1, 3) : 0;
+			
+			fixed[i] = (fabs(zscore) >= 3 || isodd == 1 || failed >= 3 || frequent >= 3 || diff_loc == 1);
+			flaggedFixed += fixed[i];
+		}
+		
+		double t1 = nowSeconds() - start;
+		if(t1 < rowByRow) rowByRow = t1;
+		
+		start = nowSeconds();
+		currentKernel()(cols.amount, cols.hour, count, mean, stdDev, 1, z, flags);
+		ruleRuns(&cols, flags, burst);
+		flagged = evaluateRules(&cols, flags, burst, verdict, 1, 3);
+		
+		double t2 = nowSeconds() - start;
+		if(t2 < compiled) compiled = t2;
+	}
+	
+	long mismatches = 0;
+	
+	for(long i = 0; i < count; i++) {
+		if((verdict[i] != 0) != fixed[i]) mismatches++;
+	}
+	
+	printf("%ld transactions\n", count);
+	printf("fixed rules, row by row : %10.3f ms (%6.1f ns/tx), %ld flagged\n", rowByRow * 1000, rowByRow * 1e9 / count, flaggedFixed);
+	printf("compiled rule set       : %10.3f ms (%6.1f ns/tx), %ld flagged, %ld rows differ\n", compiled * 1000, compiled * 1e9 / count, flagged, mismatches);
+	
+	free(cols.amount); free(cols.epoch); free(cols.hour); free(cols.status); free(cols.country); free(cols.state);
+	free(z); free(flags); free(burst); free(verdict); free(fixed);
+}
+
+/* Features, rule verdicts and Naive Bayes counts of the whole history, computed once per load or append and 
+* shared by fraudAlert, flag and findFreq until the history changes (an append clears valid).
+* Time Complexity : O(N) the first time, O(1) after.
+*/
+const txFeatures *historyFeatures(item *endUser) {
+	
+	txColumns *cols = &(endUser->cols);
+	txFeatures *f = &(endUser->features);
+	
+	if(f->valid && f->count == cols->count) return f;
+	
+	if(f->capacity < cols->count || f->z == NULL) {
+		freeFeatures(f);
+		f->capacity = (cols->count > 0) ? cols->count : 1;
+		f->z = (float*)malloc(sizeof(float) * f->capacity);
+		f->flags = (unsigned char*)malloc(f->capacity);
+		f->burst = (int*)malloc(sizeof(int) * f->capacity);
+		f->rules = (unsigned char*)malloc(f->capacity);
+		f->km = (float*)malloc(sizeof(float) * f->capacity);
+	}
+	
+	int computeZ = !profileEnabled();
+	
+	if(!computeZ) {
+		float *z = historyZScores(endUser);	// each one against its own window, inherently sequential
+		memcpy(f->z, z, sizeof(float) * cols->count);
+		free(z);
+	}
+	
+	currentKernel()(cols->amount, cols->hour, cols->count, endUser->mean, endUser->stdDev, computeZ, f->z, f->flags);
+	ruleRuns(cols, f->flags, f->burst);
+	travelRuns(cols, f->km, f->flags);
+	f->flagged = evaluateRules(cols, f->flags, f->burst, f->rules, findLocation(endUser->client.address.country), findLocation(endUser->client.address.state));
+	
+	flagRollups(cols, f->rules);
+	
+	memset(&(f->amt), 0, sizeof(f->amt));
+	memset(&(f->loc), 0, sizeof(f->loc));
+	memset(&(f->time), 0, sizeof(f->time));
+	memset(&(f->st), 0, sizeof(f->st));
+	tallyRules(cols, f, &(f->amt), &(f->loc), &(f->time), &(f->st));
+	
+	f->count = cols->count;
+	f->valid = 1;
+	
+	return f;
+}
+
+void freeFeatures(txFeatures *f) {
+	
+	free(f->z);
+	free(f->flags);
+	free(f->burst);
+	free(f->rules);
+	free(f->km);
+	memset(f, 0, sizeof(*f));
+}
+
+/* Feature kernel benchmark (./credit --bench-features [n]) on n synthetic transactions : 
+* every kernel this cpu supports, in million transactions per second, checked against the scalar results.
+*/
+void benchmarkFeatures(long count) {
+	
+	float *amount = (float*)malloc(sizeof(float) * count);
+	unsigned char *hour = (unsigned char*)malloc(count);
+	float *zRef = (float*)malloc(sizeof(float) * count);
+	unsigned char *flagsRef = (unsigned char*)malloc(count);
+	float *z = (float*)malloc(sizeof(float) * count);
+	unsigned char *flags = (unsigned char*)malloc(count);
+	unsigned long long seed = 88172645463325252ULL;
+	
+	if(amount == NULL || hour == NULL || zRef == NULL || flagsRef == NULL || z == NULL || flags == NULL) {
+		printf(RED "Not enough memory for %ld transactions\n" RESET, count);
+		free(amount); free(hour); free(zRef); free(flagsRef); free(z); free(flags);
+		return;
+	}
+	
+	for(long i = 0; i < count; i++) {
+		seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+		amount[i] = (float)(seed % 2000000) / 100.0f;
+		hour[i] = (seed >> 32) % 24;
+	}
+	
+	const char *names[] = {"scalar", "AVX2", "AVX-512"};
+	int levels[] = {KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512};
+	
+	for(int k = 0; k < 3; k++) {
+		
+		if(setFeatureKernel(levels[k]) != levels[k]) {
+			printf("%-8s : not supported on this cpu\n", names[k]);
+			continue;
+		}
+		
+		featureKernel kernel = currentKernel();
+		double best = 1e30;
+		
+		for(int round = 0; round < 5; round++) {
+			double start = nowSeconds();
+			kernel(amount, hour, count, 5000.0f, 3000.0f, 1, (k == 0) ? zRef : z, (k == 0) ? flagsRef : flags);
+			double t = nowSeconds() - start;
+			if(t < best) best = t;
+		}
+		
+		long mismatches = 0;
+		if(k > 0) {
+			for(long i = 0; i < count; i++) {
+				if(z[i] != zRef[i] || flags[i] != flagsRef[i]) mismatches++;
+			}
+		}
+		
+		printf("%-8s : %ld transactions in %8.3f ms, %8.1f M tx/s, %ld mismatches\n", names[k], count, best * 1000, count / best / 1e6, mismatches);
+	}
+	
+	setFeatureKernel(KERNEL_BEST);
+	
+	free(amount); free(hour); free(zRef); free(flagsRef); free(z); free(flags);
+}
+
+// z-score of a new amount against the live profile (or the all-time figures without a window).
+
+float liveZScore(item *endUser, float amount) {
+	
+	if(!profileEnabled()) return (amount - endUser->mean)/(endUser->stdDev);
+	
+	return profileZ(&(endUser->profile), amount, endUser);
+}
+
+// Flagged counts of the buckets -> the flagged field of every prefix, in one pass.
+
+static void rebuildFlagged(rollupTable *table, const long long *perBucket) {
+	
+	if(table->prefix == NULL) return;
+	
+	long long running = 0;
+	table->prefix[0].flagged = 0;
+	
+	for(long b = 0; b < table->buckets; b++) {
+		running += perBucket[b];
+		table->prefix[b + 1].flagged = running;
+	}
+}
+
+/* Sets the fraud column from the rule verdicts and rebuilds the flagged counts of the day and month rollups, 
+* so a row that is no longer flagged after the mean moved is taken back out as well.
+* The flags are counted per bucket first and each prefix is written once, instead of one rollupAdd per flagged row.
+* Time Complexity : O(N + B) for B day buckets.
+*/
+void flagRollups(txColumns *cols, const unsigned char *rules) {
+	
+	long long *days = (long long*)calloc(cols->days.buckets + 1, sizeof(long long));
+	long long *months = (long long*)calloc(cols->months.buckets + 1, sizeof(long long));
+	
+	for(long i = 0; i < cols->count; i++) {
+		
+		cols->fraud[i] = (rules[i] != 0);
+		if(!cols->fraud[i]) continue;
+		
+		long d = dayNumber(cols->row[i]->date_of_payment) - cols->days.first;
+		long m = monthNumber(cols->row[i]->date_of_payment) - cols->months.first;
+		
+		if(d >= 0 && d < cols->days.buckets) days[d]++;	// every row has its bucket, columnsAppend made it
+		if(m >= 0 && m < cols->months.buckets) months[m]++;
+	}
+	
+	rebuildFlagged(&(cols->days), days);
+	rebuildFlagged(&(cols->months), months);
+	
+	free(days);
+	free(months);
+}
+
+long dayNumber(date d) {
+	
+	struct tm midnight;
+	memset(&midnight, 0, sizeof(midnight));
+	
+	long long epoch = toEpoch(d, midnight);
+	
+	return (long)(epoch >= 0 ? epoch / 86400 : -((-epoch + 86399) / 86400));
+}
+
+long monthNumber(date d) {
+	return d.year * 12L + d.month - 1;
+}
+
+static void rollupSum(rollup *a, rollup b) {
+	
+	a->count += b.count;
+	a->sum += b.sum;
+	a->sumSq += b.sumSq;
+	a->failed += b.failed;
+	a->flagged += b.flagged;
+}
+
+/* Adds delta to the bucket of period. The table grows at either end as needed.
+* Time Complexity : O(1) for the latest period, which is where the rows of a csv in date order and the appended rows land; 
+* O(B) for an older one (the prefixes after it are updated), B being the number of buckets.
+*/
+void rollupAdd(rollupTable *table, long period, rollup delta) {
+	
+	if(table->prefix == NULL) {
+		table->capacity = 64;
+		table->prefix = (rollup*)calloc(table->capacity, sizeof(rollup));
+		table->first = period;
+		table->buckets = 1;
+	}
+	
+	long shift = (period < table->first) ? table->first - period : 0;
+	long buckets = (period - table->first + 1 > table->buckets) ? period - table->first + 1 : table->buckets + shift;
+	
+	if(buckets + 1 > table->capacity) {
+		
+		long capacity = table->capacity;
+		while(buckets + 1 > capacity) capacity *= 2;
+		
+		table->prefix = (rollup*)realloc(table->prefix, sizeof(rollup) * capacity);
+		table->capacity = capacity;
+	}
+	
+	if(shift > 0) {
+		// new empty buckets in front : every prefix moves right, the new ones are 0
+		memmove(table->prefix + shift, table->prefix, sizeof(rollup) * (table->buckets + 1));
+		memset(table->prefix, 0, sizeof(rollup) * shift);
+		table->first = period;
+	}
+	
+	for(long b = table->buckets + shift + 1; b <= buckets; b++) {
+		table->prefix[b] = table->prefix[b - 1];	// new empty buckets at the end
+	}
+	
+	table->buckets = buckets;
+	
+	for(long b = period - table->first + 1; b <= table->buckets; b++) {
+		rollupSum(&(table->prefix[b]), delta);
+	}
+}
+
+/* Totals of the periods [fromPeriod, toPeriod], clipped to the table.
+* Time Complexity : O(1).
+*/
+rollup rollupRange(const rollupTable *table, long fromPeriod, long toPeriod) {
+	
+	rollup r = {0, 0.0, 0.0, 0, 0};
+	
+	if(table->prefix == NULL) return r;
+	
+	long lo = fromPeriod - table->first;
+	long hi = toPeriod - table->first + 1;
+	
+	if(lo < 0) lo = 0;
+	if(hi > table->buckets) hi = table->buckets;
+	if(lo >= hi) return r;
+	
+	const rollup *a = &(table->prefix[lo]), *b = &(table->prefix[hi]);
+	
+	r.count = b->count - a->count;
+	r.sum = b->sum - a->sum;
+	r.sumSq = b->sumSq - a->sumSq;
+	r.failed = b->failed - a->failed;
+	r.flagged = b->flagged - a->flagged;
+	
+	return r;
+}
+
+void freeRollups(rollupTable *table) {
+	
+	free(table->prefix);
+	memset(table, 0, sizeof(*table));
+}
+
+void printRollup(const char *label, rollup r) {
+	
+	double mean = (r.count > 0) ? r.sum / r.count : 0.0;
+	double var = (r.count > 0) ? r.sumSq / r.count - mean * mean : 0.0;
+	
+	printf("%s : %lld transactions, total %.2f, mean %.2f, std dev %.2f, %lld failed, %lld flagged \n", label, r.count, r.sum, mean, sqrt(var > 0 ? var : 0), r.failed, r.flagged);
+}
+
+/* Totals of the transactions between two dates from the day rollups, whatever the size of the history.
+* The flagged count comes from the rule stage, which runs at the end of every load and append.
+*/
+void spendBetween(item *endUser, date from, date to) {
+	
+	char label[64];
+	snprintf(label, sizeof(label), "%d-%d-%d to %d-%d-%d", from.day, from.month, from.year, to.day, to.month, to.year);
+	
+	printRollup(label, rollupRange(&(endUser->cols.days), dayNumber(from), dayNumber(to)));
+}
+
+// One line per month of the history, from the month rollups.
+
+void monthlySummary(item *endUser) {
+	
+	const rollupTable *months = &(endUser->cols.months);
+	
+	for(long b = 0; b < months->buckets; b++) {
+		
+		long period = months->first + b;
+		rollup r = rollupRange(months, period, period);
+		
+		if(r.count == 0) continue;
+		
+		char label[32];
+		snprintf(label, sizeof(label), "%02ld-%ld", period % 12 + 1, period / 12);
+		printRollup(label, r);
+	}
+}
+
+/* Inverted location index : place key -> posting list. 
+* Positions are added in increasing order (load, then append), so every posting list stays sorted without any sorting.
+*/
+static unsigned int placeHash(locId key) {
+	
+	unsigned long long h = (unsigned int)key.city;
+	h = h * 0x9E3779B97F4A7C15ULL + (unsigned int)key.state;
+	h = h * 0x9E3779B97F4A7C15ULL + (unsigned int)key.country;
+	h ^= h >> 31;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	
+	return (unsigned int)(h ^ (h >> 29));
+}
+
+static int samePlace(locId a, locId b) {
+	return a.city == b.city && a.state == b.state && a.country == b.country;
+}
+
+static posting *placeSlot(posting *slots, int size, locId key) {
+	
+	unsigned int k = placeHash(key) & (size - 1);
+	
+	while(slots[k].pos != NULL && !samePlace(slots[k].key, key)) {
+		k = (k + 1) & (size - 1);
+	}
+	
+	return &slots[k];
+}
+
+static void growPlaceIndex(placeIndex *index) {
+	
+	int size = (index->size == 0) ? 16 : index->size * 2;
+	posting *slots = (posting*)calloc(size, sizeof(posting));
+	
+	for(int i = 0; i < index->size; i++) {
+		if(index->slots[i].pos != NULL) {
+			*placeSlot(slots, size, index->slots[i].key) = index->slots[i];
+		}
+	}
+	
+	index->bytes += (long)(size - index->size) * sizeof(posting);
+	free(index->slots);
+	index->slots = slots;
+	index->size = size;
+}
+
+/* Appends pos to the posting list of key.
+* Time Complexity : amortized O(1).
+*/
+void placeIndexAdd(placeIndex *index, locId key, int pos) {
+	
+	if(2 * (index->used + 1) > index->size) growPlaceIndex(index);
+	
+	posting *list = placeSlot(index->slots, index->size, key);
+	
+	if(list->pos == NULL) {
+		list->key = key;
+		list->cap = 4;
+		list->count = 0;
+		list->pos = (int*)malloc(sizeof(int) * list->cap);
+		index->bytes += sizeof(int) * list->cap;
+		index->used++;
+	}
+	
+	else if(list->count == list->cap) {
+		index->bytes += sizeof(int) * list->cap;
+		list->cap *= 2;
+		list->pos = (int*)realloc(list->pos, sizeof(int) * list->cap);
+	}
+	
+	list->pos[list->count++] = pos;
+}
+
+// Returns the posting list of key, NULL if no transaction was made there.
+
+posting *placeIndexFind(placeIndex *index, locId key) {
+	
+	if(index->size == 0) return NULL;
+	
+	posting *list = placeSlot(index->slots, index->size, key);
+	
+	return (list->pos != NULL) ? list : NULL;
+}
+
+void freePlaceIndex(placeIndex *index) {
+	
+	for(int i = 0; i < index->size; i++) {
+		free(index->slots[i].pos);
+	}
+	
+	free(index->slots);
+	memset(index, 0, sizeof(*index));
+}
+
+/* Mean and population standard deviation of the successful transactions, over the amount and status columns.
+* Both passes accumulate in double (calculateMean and calculateStandardDeviation use float and lose digits on long histories).
+* Time Complexity : O(N).
+*/
+void columnStats(txColumns *cols, float *mean, float *stdDev) {
+	
+	double sum = 0.0;
+	long count = 0;
+	
+	for(long i = 0; i < cols->count; i++) {
+		if(cols->status[i] == 'S' || cols->status[i] == 's') {
+			sum += cols->amount[i];
+			count++;
+		}
+	}
+	
+	if(count == 0) {
+		*mean = 0.0;
+		*stdDev = 0.0;
+		return;
+	}
+	
+	double m = sum / count;
+	double sq = 0.0;
+	
+	for(long i = 0; i < cols->count; i++) {
+		if(cols->status[i] == 'S' || cols->status[i] == 's') {
+			double diff = cols->amount[i] - m;
+			sq += diff * diff;
+		}
+	}
+	
+	*mean = (float)m;
+	*stdDev = (float)sqrt(sq / count);
+}
+
+/* Frees every node of the date BST.
+* Time Complexity : O(N).
+*/
+void freeTree(transaction *root) {
+	
+	if(root == NULL) return;
+	
+	freeTree(root->left);
+	freeTree(root->right);
+	free(root);
+}
+
+/* Releases the list and the BST of a user and marks the history as not loaded. 
+* The user stays in the map, the history is loaded again on the next cacheFind.
+*/
+void freeHistory(item *endUser) {
+	
+	if(endUser->pool != NULL) {
+		arenaDestroy(endUser->pool);	// every node of the list and the tree at once
+		endUser->pool = NULL;
+		init_dll(&(endUser->list));
+	}
+	
+	else {
+		freeList(&(endUser->list));
+		freeDateTree(endUser->recent);
+		freeAmountTree(endUser->amounts);
+	}
+	
+	freeColumns(&(endUser->cols));
+	freeDateIndex(&(endUser->dates));
+	freeProfile(&(endUser->profile));
+	freeFeatures(&(endUser->features));
+	endUser->recent = NULL;
+	endUser->amounts = NULL;
+	endUser->loaded = 0;
+	endUser->memBytes = 0;
+	endUser->csvBytes = 0;
+	endUser->statCount = 0;
+	endUser->runMean = 0.0;
+	endUser->runM2 = 0.0;
+}
+
+/* Cache of loaded histories over the users of a map, with a memory budget in bytes.
+* Histories are loaded on their first cacheFind and kept in LRU order (mru ... lru) in a doubly linked list 
+* threaded through the items. When the memory charged for loaded histories passes the budget, the least recently 
+* used histories are freed.
+*/
+historyCache *initHistoryCache(Map *map, long budget) {
+	
+	historyCache *c = (historyCache*)calloc(1, sizeof(historyCache));
+	c->map = map;
+	c->budget = budget;
+	
+	return c;
+}
+
+static void lruUnlink(historyCache *c, item *it) {
+	
+	if(it->lruPrev != NULL) it->lruPrev->lruNext = it->lruNext;
+	else c->mru = it->lruNext;
+	
+	if(it->lruNext != NULL) it->lruNext->lruPrev = it->lruPrev;
+	else c->lru = it->lruPrev;
+	
+	it->lruPrev = NULL;
+	it->lruNext = NULL;
+}
+
+static void lruPushFront(historyCache *c, item *it) {
+	
+	it->lruPrev = NULL;
+	it->lruNext = c->mru;
+	
+	if(c->mru != NULL) c->mru->lruPrev = it;
+	c->mru = it;
+	
+	if(c->lru == NULL) c->lru = it;
+}
+
+/* Frees least recently used histories until the cache fits its budget. keep (the history just requested) is never evicted.
+*/
+static void cacheEvict(historyCache *c, item *keep) {
+	
+	while(c->used > c->budget && c->lru != NULL && c->lru != keep) {
+		
+		item *victim = c->lru;
+		
+		lruUnlink(c, victim);
+		c->used -= victim->charged;
+		victim->charged = 0;
+		freeHistory(victim);
+		c->evictions++;
+	}
+}
+
+/* Finds a cardholder and makes sure their history is loaded.
+* A hit moves the history to the front of the LRU list, a miss loads it (stats, if not NULL, describe that load) 
+* and evicts older histories if the budget is exceeded. Growth through appends since the last access is charged too.
+* Returns NULL if the card is not in the map; if the history could not be loaded the item is returned with loaded == 0.
+* Time Complexity : O(1) for a hit, the cost of loadUserHistory for a miss.
+*/
+item *cacheFind(historyCache *c, long int no, loadStats *stats) {
+	
+	item *it = find(c->map, no);
+	
+	if(it == NULL) {
+		return NULL;
+	}
+	
+	if(it->loaded) {
+		c->hits++;
+		lruUnlink(c, it);
+	}
+	
+	else {
+		c->misses++;
+		
+		if(loadUserHistory(it, stats) == -1) {
+			return it;
+		}
+	}
+	
+	lruPushFront(c, it);
+	c->used += it->memBytes - it->charged;
+	it->charged = it->memBytes;
+	cacheEvict(c, it);
+	
+	return it;
+}
+
+void printCacheStats(historyCache *c) {
+	
+	long total = c->hits + c->misses;
+	
+	printf(CYAN "cache : %ld hits, %ld misses (hit rate %.1f%%), %ld evictions, %.2f of %.2f MB in use\n" RESET, c->hits, c->misses, total > 0 ? 100.0 * c->hits / total : 0.0, c->evictions, c->used / (1024.0 * 1024.0), c->budget / (1024.0 * 1024.0));
+}
+
+/* Serving mode (./credit --serve [budgetMB]) : reads card numbers (hex, as at login) from stdin, one per line, 
+* looks each one up through the history cache and prints the user, the size of the history and whether it was a hit.
+* Ends with the hit / miss / eviction counters, which is what the budget should be sized from.
+*/
+void serveCards(historyCache *c) {
+	
+	char line[64];
+	
+	while(fgets(line, sizeof(line), stdin) != NULL) {
+		
+		long int no = strtol(line, NULL, 16);
+		long misses = c->misses;
+		loadStats stats;
+		
+		item *it = cacheFind(c, no, &stats);
+		
+		if(it == NULL) {
+			printf("%s", line);
+			printf(RED "  user not found\n" RESET);
+		}
+		
+		else if(!it->loaded) {
+			printf(RED "%-20s history could not be loaded\n" RESET, it->client.name);
+		}
+		
+		else {
+			printf("%-20s %8.2f KB %s\n", it->client.name, it->memBytes / 1024.0, c->misses > misses ? "miss" : "hit");
+		}
+	}
+	
+	printCacheStats(c);
+}
+
+typedef struct bulkJob {
+	
+	item **users;
+	loadStats *stats;
+	int *source;
+	long count;
+	long next;
+	
+}bulkJob;
+
+/* Worker of the bulk loader : repeatedly claims the next unloaded user with an atomic counter 
+* and loads its history. Every step of loadUserHistory is reentrant, so no lock is needed.
+*/
+static void *bulkWorker(void *arg) {
+	
+	bulkJob *job = (bulkJob*)arg;
+	
+	while(1) {
+		
+		long i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		if(i >= job->count) break;
+		
+		job->source[i] = loadUserHistory(job->users[i], &job->stats[i]);
+	}
+	
+	return NULL;
+}
+
+/* Loads the history, BST and statistics of every user in the map on a pool of threads.
+* Users are handed out one at a time from a shared counter, so a few very large histories do not stall the others.
+* Prints the rows, size, time and MB/s of every file, then the aggregate throughput over the wall clock time.
+* Returns the number of histories that were loaded.
+* Time Complexity : O(B / T) for B bytes in total on T threads (plus the longest single file).
+*/
+long bulkLoad(Map *map, int threads) {
+	
+	bulkJob job;
+	job.users = (item**)malloc(sizeof(item*) * (map->count > 0 ? map->count : 1));
+	job.count = 0;
+	job.next = 0;
+	
+	for(int i = 0; i < map->size; i++) {
+		if(map->slots[i].dist != 0) {
+			job.users[job.count++] = map->slots[i].value;
+		}
+	}
+	
+	job.stats = (loadStats*)calloc(job.count > 0 ? job.count : 1, sizeof(loadStats));
+	job.source = (int*)calloc(job.count > 0 ? job.count : 1, sizeof(int));
+	
+	if(threads < 1) threads = 1;
+	pthread_t *pool = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+	
+	double start = nowSeconds();
+	
+	for(int t = 0; t < threads; t++) {
+		pthread_create(&pool[t], NULL, bulkWorker, &job);
+	}
+	
+	for(int t = 0; t < threads; t++) {
+		pthread_join(pool[t], NULL);
+	}
+	
+	double wall = nowSeconds() - start;
+	
+	loadStats total = {0, 0, wall, 0};
+	long loaded = 0;
+	
+	for(long i = 0; i < job.count; i++) {
+		
+		if(job.source[i] == -1) {
+			printf(RED "%-20s could not be loaded\n" RESET, job.users[i]->client.name);
+			continue;
+		}
+		
+		printf("%-20s %9ld rows %10.2f KB %9.3f ms %9.2f MB/s (%s)\n", job.users[i]->client.name, job.stats[i].rows, job.stats[i].bytes / 1024.0, job.stats[i].seconds * 1000, throughputMBps(job.stats[i]), job.source[i] == 1 ? "snapshot" : "csv");
+		
+		total.bytes += job.stats[i].bytes;
+		total.rows += job.stats[i].rows;
+		loaded++;
+	}
+	
+	printf(CYAN "\nLoaded %ld of %ld users, %ld rows, %.2f MB in %.3f s on %d threads : %.2f MB/s, %.0f rows/s\n" RESET, loaded, job.count, total.rows, total.bytes / (1024.0 * 1024.0), wall, threads, throughputMBps(total), wall > 0 ? total.rows / wall : 0.0);
+	
+	free(pool);
+	free(job.users);
+	free(job.stats);
+	free(job.source);
+	
+	return loaded;
+}
+
+/* Work stealing deque of one sweep worker : the owner pops from the tail, thieves steal from the head. 
+* Only whole users are queued and nothing is pushed once the sweep starts, so a lock per deque is enough; 
+* it is only contended when a thief and the owner meet.
+*/
+typedef struct sweepDeque {
+	
+	pthread_mutex_t lock;
+	long *tasks;
+	long head;
+	long tail;
+	
+}sweepDeque;
+
+typedef struct sweepJob {
+	
+	item **users;
+	char **out;		// flagged transactions of every user, as csv lines
+	long *outLen;
+	long count;
+	sweepDeque *deques;
+	int threads;
+	long remaining;
+	long *steals;		// per worker
+	
+}sweepJob;
+
+typedef struct sweepWorkerArg {
+	sweepJob *job;
+	int id;
+}sweepWorkerArg;
+
+static long dequePop(sweepDeque *d) {
+	
+	long task = -1;
+	
+	pthread_mutex_lock(&d->lock);
+	if(d->tail > d->head) task = d->tasks[--d->tail];
+	pthread_mutex_unlock(&d->lock);
+	
+	return task;
+}
+
+static long dequeSteal(sweepDeque *d) {
+	
+	long task = -1;
+	
+	pthread_mutex_lock(&d->lock);
+	if(d->tail > d->head) task = d->tasks[d->head++];
+	pthread_mutex_unlock(&d->lock);
+	
+	return task;
+}
+
+static const char *ruleNames[] = {"outlier", "odd_hour", "failed", "frequent", "location", "travel"};
+
+/* Evaluates the rules of one user and formats its flagged transactions : 
+* name,card,transaction id,date,time,amount,rules (joined by |).
+*/
+static void sweepUser(sweepJob *job, long u) {
+	
+	item *it = job->users[u];
+	const txFeatures *f = historyFeatures(it);
+	txColumns *cols = &(it->cols);
+	long cap = 256, len = 0;
+	char *out = (char*)malloc(cap);
+	
+	for(long i = 0; i < cols->count; i++) {
+		
+		if(f->rules[i] == 0) continue;
+		
+		node *row = cols->row[i];
+		char line[256];
+		int n = snprintf(line, sizeof(line), "%s,%lx,%s,%02d-%02d-%04d,%02d:%02d:%02d,%.2f,", it->client.name, it->client.cardNo, row->transaction_id, 
+				 row->date_of_payment.day, row->date_of_payment.month, row->date_of_payment.year, 
+				 row->time_of_payment.tm_hour, row->time_of_payment.tm_min, row->time_of_payment.tm_sec, cols->amount[i]);
+		
+		for(int r = 0, first = 1; r < 6; r++) {
+			if((f->rules[i] & (1 << r)) && n < (int)sizeof(line) - 16) {
+				n += snprintf(line + n, sizeof(line) - n, "%s%s", first ? "" : "|", ruleNames[r]);
+				first = 0;
+			}
+		}
+		
+		line[n++] = '\n';
+		
+		if(len + n + 1 > cap) {
+			while(len + n + 1 > cap) cap *= 2;
+			out = (char*)realloc(out, cap);
+		}
+		
+		memcpy(out + len, line, n);
+		len += n;
+	}
+	
+	out[len] = '\0';
+	job->out[u] = out;
+	job->outLen[u] = len;
+}
+
+/* Worker of the sweep : runs its own users from the tail of its deque, then steals from the head of the others 
+* (starting from a different victim each time) until every user has been swept.
+*/
+static void *sweepWorker(void *arg) {
+	
+	sweepWorkerArg *a = (sweepWorkerArg*)arg;
+	sweepJob *job = a->job;
+	unsigned int seed = 2463534242u + a->id;
+	
+	while(__atomic_load_n(&job->remaining, __ATOMIC_ACQUIRE) > 0) {
+		
+		long task = dequePop(&job->deques[a->id]);
+		
+		for(int k = 0; task < 0 && k < job->threads; k++) {
+			
+			seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+			int victim = (a->id + 1 + seed % job->threads) % job->threads;
+			
+			if(victim == a->id) continue;
+			task = dequeSteal(&job->deques[victim]);
+			if(task >= 0) job->steals[a->id]++;
+		}
+		
+		if(task < 0) {
+			sched_yield();	// the last users are still being swept by others
+			continue;
+		}
+		
+		sweepUser(job, task);
+		__atomic_fetch_sub(&job->remaining, 1, __ATOMIC_RELEASE);
+	}
+	
+	return NULL;
+}
+
+static int compareSweepSize(const void *a, const void *b) {
+	
+	long x = (*(item* const*)a)->cols.count, y = (*(item* const*)b)->cols.count;
+	
+	return (x < y) - (x > y);	// largest first
+}
+
+/* Runs the fraud rules over every history on threads workers. The users are dealt out largest first, round robin, 
+* so every deque starts with a similar share; a worker that runs out steals, so one very large history does not 
+* leave the other cores idle. Returns the wall clock time in seconds and adds the number of steals to steals; 
+* the formatted output is left in job->out.
+*/
+static double sweepOnce(sweepJob *job, int threads, long *steals) {
+	
+	job->threads = threads;
+	job->remaining = job->count;
+	job->deques = (sweepDeque*)malloc(sizeof(sweepDeque) * threads);
+	job->steals = (long*)calloc(threads, sizeof(long));
+	
+	for(int t = 0; t < threads; t++) {
+		pthread_mutex_init(&job->deques[t].lock, NULL);
+		job->deques[t].tasks = (long*)malloc(sizeof(long) * (job->count / threads + 1));
+		job->deques[t].head = 0;
+		job->deques[t].tail = 0;
+	}
+	
+	// largest first at the tail of every deque, so owners start on the big histories and thieves take the small ones
+	for(long i = job->count - 1; i >= 0; i--) {
+		sweepDeque *d = &job->deques[i % threads];
+		d->tasks[d->tail++] = i;
+	}
+	
+	for(long i = 0; i < job->count; i++) {
+		job->users[i]->features.valid = 0;	// every run evaluates the rules again
+		free(job->out[i]);
+		job->out[i] = NULL;
+	}
+	
+	pthread_t *pool = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+	sweepWorkerArg *args = (sweepWorkerArg*)malloc(sizeof(sweepWorkerArg) * threads);
+	double start = nowSeconds();
+	
+	for(int t = 0; t < threads; t++) {
+		args[t].job = job;
+		args[t].id = t;
+		pthread_create(&pool[t], NULL, sweepWorker, &args[t]);
+	}
+	
+	for(int t = 0; t < threads; t++) {
+		pthread_join(pool[t], NULL);
+	}
+	
+	double wall = nowSeconds() - start;
+	
+	for(int t = 0; t < threads; t++) {
+		*steals += job->steals[t];
+		pthread_mutex_destroy(&job->deques[t].lock);
+		free(job->deques[t].tasks);
+	}
+	
+	free(job->deques);
+	free(job->steals);
+	free(pool);
+	free(args);
+	
+	return wall;
+}
+
+/* Nightly fraud sweep (./credit --sweep [output.csv] [maxThreads]) : loads every history of the map, evaluates the 
+* rules of every user on 1, 2, 4 ... maxThreads work stealing workers and reports the throughput of each, 
+* then writes the flagged transactions of the last run to output (one csv line per transaction, largest history first).
+* Returns the number of flagged transactions, -1 if output cannot be written.
+*/
+long fraudSweep(Map *map, const char *output, int maxThreads) {
+	
+	if(maxThreads < 1) maxThreads = 1;
+	
+	bulkLoad(map, maxThreads);
+	
+	sweepJob job;
+	job.users = (item**)malloc(sizeof(item*) * (map->count > 0 ? map->count : 1));
+	job.count = 0;
+	
+	for(int i = 0; i < map->size; i++) {
+		if(map->slots[i].dist != 0 && map->slots[i].value->loaded) {
+			job.users[job.count++] = map->slots[i].value;
+		}
+	}
+	
+	qsort(job.users, job.count, sizeof(item*), compareSweepSize);
+	job.out = (char**)calloc(job.count > 0 ? job.count : 1, sizeof(char*));
+	job.outLen = (long*)calloc(job.count > 0 ? job.count : 1, sizeof(long));
+	
+	long rows = 0;
+	for(long i = 0; i < job.count; i++) rows += job.users[i]->cols.count;
+	
+	printf(CYAN "\nSweeping %ld users, %ld transactions\n" RESET, job.count, rows);
+	
+	double single = 0.0;
+	
+	for(int threads = 1; ; threads = (threads * 2 > maxThreads && threads < maxThreads) ? maxThreads : threads * 2) {
+		
+		double best = 1e30;
+		long steals = 0;
+		
+		for(int round = 0; round < 3; round++) {
+			
+			double wall = sweepOnce(&job, threads, &steals);
+			
+			if(wall < best) best = wall;
+		}
+		
+		if(threads == 1) single = best;
+		
+		printf("%3d threads : %9.3f ms, %12.0f tx/s, speedup %5.2f, %ld steals\n", threads, best * 1000, best > 0 ? rows / best : 0.0, best > 0 ? single / best : 0.0, steals / 3);
+		
+		if(threads >= maxThreads) break;
+	}
+	
+	FILE *fp = fopen(output, "w");
+	long flagged = 0;
+	
+	if(fp != NULL) {
+		
+		fprintf(fp, "name,card,transaction_id,date,time,amount,rules\n");
+		
+		for(long i = 0; i < job.count; i++) {
+			fwrite(job.out[i], 1, job.outLen[i], fp);
+			flagged += job.users[i]->features.flagged;
+		}
+		
+		fclose(fp);
+		printf(CYAN "%ld flagged transactions written to %s\n" RESET, flagged, output);
 	}
 	
-        temp = temp->next;  // Move to the next node
-    }
-
-    // Check for an empty list (avoid division by zero)
-    if (count == 0) {
-        printf("List is empty, returning 0.0\n");
-        return 0.0;
-    }
-
-    // Calculate mean
-    mean = mean /((float)count);
-
-    return mean;
-}
-
-/* Function to calculate the standard deviation of transaction amounts
- Formula:
- * Standard Deviation (σ) = sqrt( (1/n) * Σ(xi - μ)^2 )
- * Where:
- * - xi is each individual transaction amount
- * - μ is the mean of all transaction amounts
- * - n is the total number of transactions
- * The function calculates the squared difference between each transaction amount and the mean, 
- * sums these squared differences, and returns the square root of the average squared difference.
-*/
-
-float calculateStandardDeviation(dll *list) {
-    
-    float mean = calculateMean(list);
-    node *temp = list->head;
-    int count = 0;
-    float sum = 0.0;
-    while(temp != NULL) {
-        if (temp->status == 'S' || temp->status == 's') {
-		float diff = temp->amount - mean;
-		sum += diff * diff;
-		count++;
-        }
-        temp = temp->next;
-        
-    }
-    return sqrt(sum / (float)count);
+	else {
+		printf(RED "Could not write %s\n" RESET, output);
+		flagged = -1;
+	}
+	
+	for(long i = 0; i < job.count; i++) free(job.out[i]);
+	
+	free(job.out);
+	free(job.outLen);
+	free(job.users);
+	
+	return flagged;
 }
 
 void printMenu() {
@@ -593,6 +5904,11 @@ void printMenu() {
 	printf(CYAN"7. Show flagged transactions \n");
 	printf(CYAN"8. Search for potential frauds from recent transaction\n");
 	printf(CYAN"9. Exit Program \n");
+	printf(CYAN"10. Follow new transactions \n");
+	printf(CYAN"11. Transactions between two dates \n");
+	printf(CYAN"12. Successful transactions between two amounts \n");
+	printf(CYAN"13. Totals between two dates \n");
+	printf(CYAN"14. Monthly summary \n");
 }
 
 int getInput(int num, dll list, item *endUser) {
@@ -620,7 +5936,7 @@ int getInput(int num, dll list, item *endUser) {
 			date target;
 			scanf("%d %d %d", &(target.day), &(target.month), &(target.year));
 			int count = 0;
-			find_transactions_by_date(endUser->root, target, &count);
+			find_history_by_date(endUser, target, &count);
 			
 			if(count == 0) printf(YELLOW"\n No transactions were found for this date.\n");
 			break;
@@ -628,10 +5944,10 @@ int getInput(int num, dll list, item *endUser) {
 		
 		case 5 : {
 	
-			printf("\n Enter the location as City State Country (separated by spaces) \n");
+			printf("\n Enter the location as City State Country (separated by spaces, * as the city for a whole state, * * for a whole country) \n");
 			location place;
-			scanf("%s %s %s", place.city, place.state, place.country);
-			find_transactions_byLocation(list, place);
+			scanf("%31s %31s %31s", place.city, place.state, place.country);
+			find_transactions_byLocation(endUser, place);
 			break;
 		}
 		
@@ -640,13 +5956,23 @@ int getInput(int num, dll list, item *endUser) {
 			printf("\n The mean transaction Amount : %f \n", endUser->mean);
 			printf("The Standard Deviation : %f \n", endUser->stdDev);
 			
+			if(endUser->amounts != NULL) {
+				
+				long n = endUser->amounts->size;
+				float low = endUser->mean - endUser->stdDev, high = endUser->mean + endUser->stdDev;
+				
+				printf("Median : %f  95th percentile : %f  99th percentile : %f \n", amountPercentile(endUser->amounts, 0.5), amountPercentile(endUser->amounts, 0.95), amountPercentile(endUser->amounts, 0.99));
+				printf("Smallest : %f  Largest : %f \n", amountSelect(endUser->amounts, 0), amountSelect(endUser->amounts, n - 1));
+				printf("Within one standard deviation of the mean : %ld of %ld successful transactions \n", amountRangeCount(endUser->amounts, low, high), n);
+			}
+			
 			display_graph(endUser);
 			
 			break;
 		}
 		
 		case 7 : {
-			fraudAlert(list, endUser);
+			fraudAlert(endUser);
 			break;
 		}
 		
@@ -660,6 +5986,50 @@ int getInput(int num, dll list, item *endUser) {
 			return 0;
 		}
 		
+		case 10 : {
+			followCsv(endUser);
+			break;
+		}
+		
+		case 11 : {
+			
+			printf("\n Enter the first and the last date dd mm yyyy dd mm yyyy\n");
+			date from, to;
+			scanf("%d %d %d %d %d %d", &(from.day), &(from.month), &(from.year), &(to.day), &(to.month), &(to.year));
+			int count = 0;
+			find_history_between(endUser, from, to, &count);
+			
+			if(count == 0) printf(YELLOW"\n No transactions were found between these dates.\n");
+			break;
+		}
+		
+		case 12 : {
+			
+			printf("\n Enter the lowest and the highest amount\n");
+			float low, high;
+			scanf("%f %f", &low, &high);
+			long count = amountRangeCount(endUser->amounts, low, high);
+			long n = (endUser->amounts != NULL) ? endUser->amounts->size : 0;
+			
+			printf("%ld of %ld successful transactions are between %f and %f \n", count, n, low, high);
+			printf("%ld are below and %ld above that range \n", amountCountBelow(endUser->amounts, low, 0), n - amountCountBelow(endUser->amounts, high, 1));
+			break;
+		}
+		
+		case 13 : {
+			
+			printf("\n Enter the first and the last date dd mm yyyy dd mm yyyy\n");
+			date from, to;
+			scanf("%d %d %d %d %d %d", &(from.day), &(from.month), &(from.year), &(to.day), &(to.month), &(to.year));
+			spendBetween(endUser, from, to);
+			break;
+		}
+		
+		case 14 : {
+			monthlySummary(endUser);
+			break;
+		}
+		
 		default : {
 			printf("Invalid input \n");
 		}
@@ -886,7 +6256,7 @@ void printRecent(dll list) {
 	while(i < 10) {
 	
 		printf("Transaction : \n");
-		printf("%d/%d/%d at %s at %d:%d:%d \n", temp->date_of_payment.day, temp->date_of_payment.month, temp->date_of_payment.year, temp->payment_place.city, temp->time_of_payment.tm_hour, temp->time_of_payment.tm_min, temp->time_of_payment.tm_sec );
+		printf("%d/%d/%d at %s at %d:%d:%d \n", temp->date_of_payment.day, temp->date_of_payment.month, temp->date_of_payment.year, locationName(temp->payment_place.city), temp->time_of_payment.tm_hour, temp->time_of_payment.tm_min, temp->time_of_payment.tm_sec );
 		
 		printf("Amount %f \n", temp->amount);
 		
@@ -908,7 +6278,7 @@ void RecentToLast(dll list) {
 	
 	while(temp != NULL) {
 		printf("Transaction : \n");
-		printf("%d/%d/%d at %s at %d:%d:%d \n", temp->date_of_payment.day, temp->date_of_payment.month, temp->date_of_payment.year, temp->payment_place.city, temp->time_of_payment.tm_hour, temp->time_of_payment.tm_min, temp->time_of_payment.tm_sec );
+		printf("%d/%d/%d at %s at %d:%d:%d \n", temp->date_of_payment.day, temp->date_of_payment.month, temp->date_of_payment.year, locationName(temp->payment_place.city), temp->time_of_payment.tm_hour, temp->time_of_payment.tm_min, temp->time_of_payment.tm_sec );
 		
 		printf("Amount %f \n", temp->amount);
 		
@@ -931,7 +6301,7 @@ void oldTonew(dll list) {
 	while(temp != NULL) {
 	
 		printf("Transaction : \n");
-		printf("%d/%d/%d at %s at %d:%d:%d \n", temp->date_of_payment.day, temp->date_of_payment.month, temp->date_of_payment.year, temp->payment_place.city, temp->time_of_payment.tm_hour, temp->time_of_payment.tm_min, temp->time_of_payment.tm_sec );
+		printf("%d/%d/%d at %s at %d:%d:%d \n", temp->date_of_payment.day, temp->date_of_payment.month, temp->date_of_payment.year, locationName(temp->payment_place.city), temp->time_of_payment.tm_hour, temp->time_of_payment.tm_min, temp->time_of_payment.tm_sec );
 		
 		printf("Amount %f \n", temp->amount);
 		
@@ -991,7 +6361,7 @@ void find_transactions_by_date(transaction *root, date target_date, int *count)
         
         (*count) += 1;
         printf("Transaction : \n");
-	printf("%d/%d/%d at %s at %d:%d:%d \n", root->date_of_payment.day, root->date_of_payment.month, root->date_of_payment.year, root->payment_place.city, root->time_of_payment.tm_hour, root->time_of_payment.tm_min, root->time_of_payment.tm_sec );
+	printf("%d/%d/%d at %s at %d:%d:%d \n", root->date_of_payment.day, root->date_of_payment.month, root->date_of_payment.year, locationName(root->payment_place.city), root->time_of_payment.tm_hour, root->time_of_payment.tm_min, root->time_of_payment.tm_sec );
         
         printf("Amount %f \n", root->amount);
      	
@@ -1009,30 +6379,77 @@ void find_transactions_by_date(transaction *root, date target_date, int *count)
     return;
 }
 
-void find_transactions_byLocation(dll list, location place) {
+/* Lists the transactions of a loaded history made between from and to (both included), in date order, 
+* through the merging iterator over the date index and the appended tree.
+* Time Complexity : O(logN + K) for K transactions found, independent of the size of the history.
+*/
+void find_history_between(item *endUser, date from, date to, int *count) {
 	
-	node *temp = list.head;
-	int count = 0;
-
-	while(temp != NULL) {
+	dateCursor cur;
+	dateRangeOpen(&cur, endUser, from, to);
+	
+	for(node *temp = dateRangeNext(&cur); temp != NULL; temp = dateRangeNext(&cur)) {
 		
-		if(strcmp(temp->payment_place.country, place.country) == 0  && strcmp(temp->payment_place.state, place.state) == 0 && strcmp(temp->payment_place.city, place.city) == 0)  {
+		(*count) += 1;
+		printf("Transaction : \n");
+		printf("%d/%d/%d at %s at %d:%d:%d \n", temp->date_of_payment.day, temp->date_of_payment.month, temp->date_of_payment.year, locationName(temp->payment_place.city), temp->time_of_payment.tm_hour, temp->time_of_payment.tm_min, temp->time_of_payment.tm_sec );
 		
-			count++;
-			printf("Transaction : \n");
-			printf("%d/%d/%d at %s at %d:%d:%d \n", temp->date_of_payment.day, temp->date_of_payment.month, temp->date_of_payment.year, temp->payment_place.city, temp->time_of_payment.tm_hour, temp->time_of_payment.tm_min, temp->time_of_payment.tm_sec );
+		printf("Amount %f \n", temp->amount);
+		
+		if(temp->status == 'S' || temp->status == 's') 
+			printf(" Status : Successful \n");
 			
-			printf("Amount %f \n", temp->amount);
-		     	
-			if(temp->status == 'S' || temp->status == 's') 
-				printf(" Status : Successful \n");
-					
-			else 
-				printf(" Status : Failed\n");
-		}
+		else 
+			printf(" Status : Failed\n");
+	}
+}
+
+// A single date is the range [target_date, target_date].
+
+void find_history_by_date(item *endUser, date target_date, int *count) {
+	find_history_between(endUser, target_date, target_date, count);
+}
+
+/* Lists the transactions made at place, through the place index of the history.
+* "*" as the city lists the whole state, "*" as the state (and city) the whole country.
+* Time Complexity : O(K) for K matching transactions, the history itself is not scanned.
+*/
+void find_transactions_byLocation(item *endUser, location place) {
+	
+	locId wanted = findPlace(place);	// a name that was never interned matches no transaction
+	
+	if(strcmp(place.state, "*") == 0) {
+		wanted.state = LOC_ANY;
+		wanted.city = LOC_ANY;
+	}
+	
+	else if(strcmp(place.city, "*") == 0) {
+		wanted.city = LOC_ANY;
+	}
+	
+	posting *list = NULL;
+	
+	if(wanted.city != -1 && wanted.state != -1 && wanted.country != -1) {
+		list = placeIndexFind(&(endUser->cols.places), wanted);
+	}
+	
+	int count = 0;
+
+	for(int i = 0; list != NULL && i < list->count; i++) {
 		
+		node *temp = endUser->cols.row[list->pos[i]];
 		
-		temp = temp->next;
+		count++;
+		printf("Transaction : \n");
+		printf("%d/%d/%d at %s at %d:%d:%d \n", temp->date_of_payment.day, temp->date_of_payment.month, temp->date_of_payment.year, locationName(temp->payment_place.city), temp->time_of_payment.tm_hour, temp->time_of_payment.tm_min, temp->time_of_payment.tm_sec );
+		
+		printf("Amount %f \n", temp->amount);
+		     	
+		if(temp->status == 'S' || temp->status == 's') 
+			printf(" Status : Successful \n");
+				
+		else 
+			printf(" Status : Failed\n");
 	}
 	
 	if(count == 0) {
@@ -1046,17 +6463,19 @@ void find_transactions_byLocation(dll list, location place) {
 
 int is_odd_hour(struct tm time) {
 
-    if(time.tm_hour < 6 || time.tm_hour > 22) 
+    const ruleConfig *r = ruleSettings();
+    
+    if(time.tm_hour < r->oddBefore || time.tm_hour > r->oddAfter) 
     	return 1;
     
-    /* Example: odd hours are before 6:00:00 and after 22:00:00  */
+    /* Example: odd hours are before 6:00:00 and after 22:00:00 (odd_before and odd_after of the rule set) */
     return 0;
 }
 
 
 // Function to check if there are multiple failed transactions
 // It traverses the linked list of transactions and counts consecutive failed transactions (status 'f' or 'F')
-// If there are 3 or more consecutive failed transactions, it returns 1 (indicating fraud), otherwise 0.
+// If there are failed_run (3) or more consecutive failed transactions, it returns 1 (indicating fraud), otherwise 0.
 
 int multiple_failed_transactions(node *temp) {
 	
@@ -1068,38 +6487,35 @@ int multiple_failed_transactions(node *temp) {
 		temp = temp->next;
 	}
 	
-	return (count >= 3 ? 1 : 0);
+	return (count >= ruleSettings()->failedRun ? 1 : 0);
 }
 
-// Function to check if two transactions occurred within a small time frame (5 minutes)
-
-int is_small_time_frame(struct tm last_time, struct tm current_time) {
-
-	last_time.tm_isdst = -1;  
-	current_time.tm_isdst = -1;
-
-	    
-	last_time.tm_mday = 1;   // Set a default day (valid day in tm structure)
-	last_time.tm_mon = 0;     // Set to January (valid month)
-	last_time.tm_year = 100;  // Set a default year (valid)
-
-	current_time.tm_mday = 1;   // Set a default day (valid day in tm structure)
-	current_time.tm_mon = 0;     // Set to January (valid month)
-	current_time.tm_year = 100;  // Set a default year (valid)
-
-
-	time_t last_time_t = mktime(&last_time);
-	time_t current_time_t = mktime(&current_time);
-
+/* Seconds since 01-01-1970 00:00:00 for a payment date and time, taken as they are written in the csv 
+* (no time zone or daylight saving adjustment, so it never calls mktime).
+* Uses the days-from-civil conversion of the proleptic Gregorian calendar.
+* Time Complexity : O(1).
+*/
+long long toEpoch(date d, struct tm t) {
+	
+	long long y = d.year - (d.month <= 2);
+	long long era = (y >= 0 ? y : y - 399) / 400;
+	long long yoe = y - era * 400;
+	long long mp = (d.month + 9) % 12;
+	long long doy = (153 * mp + 2) / 5 + d.day - 1;
+	long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	long long days = era * 146097 + doe - 719468;
+	
+	return days * 86400 + t.tm_hour * 3600 + t.tm_min * 60 + t.tm_sec;
+}
 
-	if (last_time_t == (time_t) -1 || current_time_t == (time_t) -1) {
-		fprintf(stderr, "Error: mktime failed\n");
-		return 0;  // Return some default value if mktime fails
-	}
+// Function to check if two transactions occurred within a small time frame (5 minutes)
+// Both times are epoch seconds precomputed at ingest, so the check also works across midnight.
 
-	double seconds_diff = difftime(current_time_t, last_time_t);
-	    
-	return seconds_diff < 300; // Check if the difference is less than 5 minutes
+int is_small_time_frame(long long last_time, long long current_time) {
+	
+	long long seconds_diff = current_time - last_time;
+	
+	return (seconds_diff < 0 ? -seconds_diff : seconds_diff) < ruleSettings()->burstSeconds; // Check if the difference is less than 5 minutes (burst_seconds)
 }
 
 // Function to detect frequent transactions within a short time frame (5 minutes)
@@ -1112,7 +6528,7 @@ int frequent_trans(node *temp) {
 	while(temp != NULL) {
 
 		if(prev != NULL) {
-			if(is_small_time_frame(prev->time_of_payment, temp->time_of_payment) == 1 && compareDate(temp->date_of_payment, prev->date_of_payment) == 0) {
+			if(is_small_time_frame(prev->epoch, temp->epoch) == 1) {
 				
 				count++;
 			}
@@ -1129,15 +6545,165 @@ int frequent_trans(node *temp) {
 	return count;
 }
 
-int is_location_anomaly(location current, location last, location home) {
+int is_location_anomaly(locId current, locId last, locId home) {
  
 	// Check if countries differ :
-	if(strcmp(current.country, last.country) == 0 && strcmp(current.country , home.country) == 0) {
+	if(current.country == last.country && current.country == home.country) {
 		return 0;
 	}	
 	
 	// check if states differ : 
-	else if(strcmp(current.state, last.state) == 0 && strcmp(current.state , home.state) == 0) {
+	else if(current.state == last.state && current.state == home.state) {
+		return 0;
+	}
+	
+	return 1;
+}
+
+/* Column versions of the rule helpers above, used by the scans over txColumns. 
+*/
+
+int epochHour(long long epoch) {
+	
+	long long secs = epoch % 86400;
+	if(secs < 0) secs += 86400;
+	
+	return (int)(secs / 3600);
+}
+
+int is_odd_epoch(long long epoch) {
+	
+	return (ruleSettings()->hourFlags[epochHour(epoch)] & FEAT_ODD) != 0;
+}
+
+/* Same as multiple_failed_transactions : 1 if 3 or more consecutive failed transactions start at i.
+* Walks the rest of the run, so calling it for every row is O(N^2) on a long burst; the scans use ruleRuns instead.
+*/
+
+int failedRunAt(txColumns *cols, long i) {
+	
+	long count = 0;
+	
+	while(i < cols->count && (cols->status[i] == 'f' || cols->status[i] == 'F')) {
+		count++;
+		i++;
+	}
+	
+	return (count >= ruleSettings()->failedRun ? 1 : 0);
+}
+
+// Same as frequent_trans : the number of consecutive transactions from i on that are each within 5 minutes of the previous one.
+// O(length of the burst) per call like failedRunAt, kept as the reference for ruleRuns.
+
+int frequentAt(txColumns *cols, long i) {
+	
+	int count = 0;
+	
+	for(long j = i + 1; j < cols->count; j++) {
+		
+		if(is_small_time_frame(cols->epoch[j - 1], cols->epoch[j]) == 1) {
+			count++;
+		}
+		
+		else {
+			break;
+		}
+	}
+	
+	return count;
+}
+
+/* failedRunAt and frequentAt for every row in one pass, from the last row back : the failed run and the burst 
+* starting at row j are the ones starting at j + 1, one longer, or empty. Both lengths are updated without a branch, 
+* so random statuses and gaps cost no mispredictions. The run length and the burst gap come from the rule set.
+* Time Complexity : O(N).
+*/
+void ruleRuns(const txColumns *cols, unsigned char *flags, int *burst) {
+	
+	long n = cols->count;
+	long minFailed = ruleSettings()->failedRun;
+	long long gap = ruleSettings()->burstSeconds;
+	long failedRun = 0;	// consecutive failures from row j on
+	long burstRun = 0;	// following payments within gap of the previous one, from row j on
+	
+	for(long j = n - 1; j >= 0; j--) {
+		
+		long failed = (cols->status[j] == 'f') | (cols->status[j] == 'F');
+		failedRun = (failedRun + 1) & -failed;
+		flags[j] |= (failedRun >= minFailed) * FEAT_FAILED_RUN;
+		
+		burst[j] = (int)burstRun;
+		
+		if(j > 0) {
+			long close = llabs(cols->epoch[j] - cols->epoch[j - 1]) < gap;	// is_small_time_frame
+			burstRun = (burstRun + 1) & -close;
+		}
+	}
+}
+
+/* Burst benchmark (./credit --bench-bursts [n] [burst]) : n synthetic transactions made of alternating bursts of 
+* burst failed payments and burst payments a minute apart, the worst case of the per-row scans. 
+* Times failedRunAt and frequentAt on every row against one ruleRuns pass and checks that they agree.
+*/
+void benchmarkBursts(long count, long burst) {
+	
+	txColumns cols;
+	memset(&cols, 0, sizeof(cols));
+	cols.count = count;
+	cols.status = (char*)malloc(count);
+	cols.epoch = (long long*)malloc(sizeof(long long) * count);
+	unsigned char *flags = (unsigned char*)calloc(count, 1);
+	int *runs = (int*)malloc(sizeof(int) * count);
+	long long t = 1500000000;
+	
+	if(cols.status == NULL || cols.epoch == NULL || flags == NULL || runs == NULL) {
+		printf(RED "Not enough memory for %ld transactions\n" RESET, count);
+		free(cols.status); free(cols.epoch); free(flags); free(runs);
+		return;
+	}
+	
+	for(long i = 0; i < count; i++) {
+		
+		long block = i / burst;
+		
+		cols.status[i] = (block % 2 == 0) ? 'F' : 'S';
+		t += (block % 2 == 1) ? 60 : 3600;	// failures an hour apart, successes a minute apart
+		cols.epoch[i] = t;
+	}
+	
+	double start = nowSeconds();
+	ruleRuns(&cols, flags, runs);
+	double single = nowSeconds() - start;
+	
+	long mismatches = 0;
+	start = nowSeconds();
+	
+	for(long i = 0; i < count; i++) {
+		
+		int failed = failedRunAt(&cols, i);
+		int frequent = frequentAt(&cols, i);
+		
+		if(failed != ((flags[i] & FEAT_FAILED_RUN) != 0) || frequent != runs[i]) mismatches++;
+	}
+	
+	double perRow = nowSeconds() - start;
+	
+	printf("%ld transactions in bursts of %ld\n", count, burst);
+	printf("per row scans : %10.3f ms\n", perRow * 1000);
+	printf("one pass      : %10.3f ms (%.1f ns/tx), %ld mismatches\n", single * 1000, single * 1e9 / count, mismatches);
+	
+	free(cols.status); free(cols.epoch); free(flags); free(runs);
+}
+
+// Same as is_location_anomaly, for transaction i and i - 1 of the columns and the ids of the home address.
+
+int locationAnomalyAt(txColumns *cols, long i, int homeCountry, int homeState) {
+	
+	if(cols->country[i] == cols->country[i - 1] && cols->country[i] == homeCountry) {
+		return 0;
+	}
+	
+	else if(cols->state[i] == cols->state[i - 1] && cols->state[i] == homeState) {
 		return 0;
 	}
 	
@@ -1151,68 +6717,66 @@ int is_location_anomaly(location current, location last, location home) {
 				     --- Multiple failed transactions in small time window.
 *  Higher transaction amount than usual. 
 *  Other factors include z-score as well.
-* Time Complexity : 
-* Assuming that the helper functions are efficient and the typical number of consecutive failed or 
-* frequent transactions is small, the overall time complexity of the fraudAlert function is: O(N).	
+* Time Complexity : O(N), the runs of failed and frequent transactions come from one pass of ruleRuns.	
 */ 
 
-void fraudAlert(dll list, item *endUser) {
+void fraudAlert(item *endUser) {
 	
-	node *tmp = list.head;
+	txColumns *cols = &(endUser->cols);
+	const txFeatures *f = historyFeatures(endUser);
 	int count = 0;
-	while(tmp != NULL) {
+	
+	for(long i = 0; i < cols->count; i++) {
 		
 		/* A Z-score standardizes the comparison of individual transaction amounts by showing how many standard deviations 
 		 * an individual transaction is away from the mean. It gives you a sense of whether a transaction is above or 
 		 * below average and by how much in terms of standard deviations.
 		*/
 		
-		float zscore = (tmp->amount - endUser->mean)/(endUser->stdDev);
-		int isodd = is_odd_hour(tmp->time_of_payment);
-		int multipleFailed = multiple_failed_transactions(tmp);
-		int frequent_payments = frequent_trans(tmp);
-		int diff_loc = 0;
-		
-		if(tmp->prev != NULL) {
-			diff_loc = is_location_anomaly(tmp->payment_place, tmp->prev->payment_place, endUser->client.address);
-		}
+		float zscore = f->z[i];
+		unsigned char rules = f->rules[i];
 		 
-		if(fabs(zscore) >= 3 || isodd == 1 || multipleFailed == 1 || frequent_payments >= 3 || diff_loc == 1) {
+		if(rules != 0) {
+			
+			node *tmp = cols->row[i];	// the list node, for the fields that are only printed
 			
 			count++;
 			printf(RED"Transaction id : %s \n", tmp->transaction_id);
 			printf(RED"%d-%d-%d at ", tmp->date_of_payment.day, tmp->date_of_payment.month, tmp->date_of_payment.year);
 			printf(RED"%d:%d:%d \n", tmp->time_of_payment.tm_hour, tmp->time_of_payment.tm_min, tmp->time_of_payment.tm_sec);
 			
-			if(fabs(zscore) > 3) {
+			if(rules & RULE_OUTLIER) {
 			
-				printf(RED"Outlier detected : \n amount (zscore = %f) : %f \n", zscore, tmp->amount);
+				printf(RED"Outlier detected : \n amount (zscore = %f) : %f \n", zscore, cols->amount[i]);
 			}	
 			
-			if(isodd == 1) {
+			if(rules & RULE_ODD) {
 			
-				printf(RED"Payment of %f at odd hour \n", tmp->amount);
+				printf(RED"Payment of %f at odd hour \n", cols->amount[i]);
 			}
 			
-			if(multipleFailed == 1) {
+			if(rules & RULE_FAILED) {
 				
 				printf(RED"multiple failed transactions detected \n");
 			}
 			
-			if(frequent_payments > 3) {
+			if(rules & RULE_FREQUENT) {
 				
 				printf(RED"Multiple transactions detected \n");
 			}
 			
-			if(diff_loc == 1) {
+			if(rules & RULE_LOCATION) {
 				
 				printf(RED"Transaction at a new loction detected \n");
 			}
 			
+			if(rules & RULE_TRAVEL) {
+				
+				printf(RED"Impossible travel : %.0f km from the previous transaction in %lld minutes \n", f->km[i], llabs(cols->epoch[i] - cols->epoch[i - 1]) / 60);
+			}
+			
 			printf("\n");	
 		}	
-		
-		tmp = tmp->next;
 	}
 	
 	if(count == 0) {
@@ -1223,71 +6787,49 @@ void fraudAlert(dll list, item *endUser) {
 	return;
 }
 
-/*This traverses through the list and identifies and flags the transactions as fraud or non fraud. 
-* Uses the same conditions to flag the transactions as used in the function fraudAlert.
-* Time Complexity : O(N).
+/* The number of transactions and of flagged ones, from the rule stage (the rows are marked in cols.fraud there). 
+* A transaction is flagged by the same rules that fraudAlert reports.
+* Time Complexity : O(1) once the rules are evaluated.
 */
 
 int *flag(item *endUser) {
 	
-	node *temp = endUser->list.head;
+	const txFeatures *f = historyFeatures(endUser);
 	int *freq = (int*)malloc(sizeof(int)*2);
-	int count = 0;
-	int cnt = 0;
-	
-	while(temp != NULL) {
-		
-		float zscore = (temp->amount - endUser->mean)/(endUser->stdDev);
-		int isodd = is_odd_hour(temp->time_of_payment);
-		int multipleFailed = multiple_failed_transactions(temp);
-		int frequent_payments = frequent_trans(temp);
-		int diff_loc = 0;
-		
-		if(temp->prev != NULL) {
-			diff_loc = is_location_anomaly(temp->payment_place, temp->prev->payment_place, endUser->client.address);
-		}
-		
-		if(diff_loc == 1) {
-			temp->fraud = 1;
-		}
-		
-		if(fabs(zscore) >= 3 || multipleFailed >= 3) {
-			temp->fraud = 1;
-		}
-		
-		if(fabs(zscore) >= 3 || isodd == 1) {
-			temp->fraud = 1;
-		}
-		
-		if(frequent_payments == 1){
-			temp->fraud = 1;
-		}
-		
-		if(temp->fraud == 1) cnt++;
-		
-		temp = temp->next;
-		count++;
-	}
 	
-	freq[0] = count;
-	freq[1] = cnt;
+	freq[0] = f->count;
+	freq[1] = f->flagged;
 	
 	return freq;
 }
 
-/* Time Complexity : O(N).
+/* The Naive Bayes counts of the history, tallied by the rule stage.
+* Time Complexity : O(1) once the rules are evaluated.
 */
 void findFreq(item *endUser, countAmt *amt_cat, countLoc *loc_cat, countTime *time_cat, countStatus *st_cat) {
 	
-	node *temp = endUser->list.head;
+	const txFeatures *f = historyFeatures(endUser);
 	
-	while(temp != NULL) {
+	*amt_cat = f->amt;
+	*loc_cat = f->loc;
+	*time_cat = f->time;
+	*st_cat = f->st;
+}
+
+/* Counts the Naive Bayes categories over the columns of the history (amount, time, country, status and the rule verdicts).
+* Time Complexity : O(N).
+*/
+static void tallyRules(txColumns *cols, const txFeatures *f, countAmt *amt_cat, countLoc *loc_cat, countTime *time_cat, countStatus *st_cat) {
+	
+	int india = findLocation(ruleSettings()->homeCountry);	// home country of the rule set
+	
+	for(long i = 0; i < cols->count; i++) {
 		
-		float z = (temp->amount - endUser->mean)/(endUser->stdDev);
+		int bucket = f->flags[i] & FEAT_BUCKET;	// |z| <= bucket_low, <= bucket_high or above
+		int part = (f->flags[i] >> FEAT_PART_SHIFT) & 3;
 		char c, tim;
-		struct tm t = temp->time_of_payment;
 		
-		if(strcmp(temp->payment_place.country, "India") == 0) {
+		if(cols->country[i] == india) {
 			c = 'i'; // india 
 		}
 		
@@ -1295,10 +6837,10 @@ void findFreq(item *endUser, countAmt *amt_cat, countLoc *loc_cat, countTime *ti
 			c = 'n'; // not india 
 		}
 	
-		if(t.tm_hour < 6 || t.tm_hour > 22) {
+		if(part == PART_ODD) {
 			tim = 'o'; // odd hours
 		}
-		else if(t.tm_hour > 6 && t.tm_hour < 16) {
+		else if(part == PART_DAY) {
 			tim = 'm'; //morning or day 
 		}
 		
@@ -1306,17 +6848,17 @@ void findFreq(item *endUser, countAmt *amt_cat, countLoc *loc_cat, countTime *ti
 			tim = 'e'; // evening 
 		}
 		
-		if(temp->fraud == 1) {
+		if(f->rules[i] != 0) {
 			
 			// x1
-			if(fabs(z) <= 1.5) {
+			if(bucket == 0) {
 				amt_cat->z1f += 1;
 				amt_cat->total_f += 1;
 				amt_cat->total += 1;
 				
 			}
 			
-			else if(fabs(z) <= 3) {
+			else if(bucket == 1) {
 				amt_cat->z2f += 1;
 				amt_cat->total_f += 1;
 				amt_cat->total += 1;
@@ -1370,7 +6912,7 @@ void findFreq(item *endUser, countAmt *amt_cat, countLoc *loc_cat, countTime *ti
 			}
 			
 			//x4;
-			if(temp->status == 'f' || temp->status == 'F') {
+			if(cols->status[i] == 'f' || cols->status[i] == 'F') {
 				
 				// Failed fraudulent transaction
 				st_cat->ff += 1;
@@ -1391,12 +6933,12 @@ void findFreq(item *endUser, countAmt *amt_cat, countLoc *loc_cat, countTime *ti
 		else {
 			
 			// x1
-			if(fabs(z) <= 1.5) {
+			if(bucket == 0) {
 				amt_cat->z1 += 1;
 				amt_cat->total += 1;
 			}
 			
-			else if(fabs(z) <= 3) {
+			else if(bucket == 1) {
 				amt_cat->z2 += 1;
 				amt_cat->total += 1;
 			}
@@ -1436,7 +6978,7 @@ void findFreq(item *endUser, countAmt *amt_cat, countLoc *loc_cat, countTime *ti
 			}
 				
 			//x4;
-			if(temp->status == 'f' || temp->status == 'F') {
+			if(cols->status[i] == 'f' || cols->status[i] == 'F') {
 				// Failed non-fraudulent transaction
 				st_cat->f += 1;
 				st_cat->total += 1;
@@ -1449,10 +6991,7 @@ void findFreq(item *endUser, countAmt *amt_cat, countLoc *loc_cat, countTime *ti
 			}
 			
 		}
-	
-		temp = temp->next;
 	}
-	
 }
 
 /*
@@ -1489,7 +7028,8 @@ void TrainModel(item *endUser, char *country, struct tm t, float at, char status
 
 	// Step 1: Calculate the Z-score to determine how unusual the transaction amount is.
 	
-	float zscore = (at - endUser->mean)/(endUser->stdDev);
+	const ruleConfig *r = ruleSettings();
+	float zscore = liveZScore(endUser, at);
 	char c;
 	char tim;
 	
@@ -1507,10 +7047,10 @@ void TrainModel(item *endUser, char *country, struct tm t, float at, char status
 	// x1
 	// Step 2: Categorize the Z-score into three levels based on thresholds (low, moderate, high deviation).
 
-	if(fabs(zscore) <= 1.5) {
+	if(fabs(zscore) <= r->bucketLow) {
 		zscore = 1;	
 	}
-	else if(fabs(zscore) <= 3) {
+	else if(fabs(zscore) <= r->bucketHigh) {
 		zscore = 2;
 	}
 	else {
@@ -1519,7 +7059,7 @@ void TrainModel(item *endUser, char *country, struct tm t, float at, char status
 	
 	// x2
 	// Step 3: Categorize the location as domestic or international.
-	if(strcmp(country, "India") == 0) {
+	if(strcmp(country, r->homeCountry) == 0) {
 		c = 'i';
 	}
 	else {
@@ -1528,10 +7068,10 @@ void TrainModel(item *endUser, char *country, struct tm t, float at, char status
 	
 	//x3
 	
-	if(t.tm_hour < 6 || t.tm_hour > 22) {
+	if(t.tm_hour < r->oddBefore || t.tm_hour > r->oddAfter) {
 		tim = 'o';
 	}
-	else if(t.tm_hour > 6 && t.tm_hour < 16) {
+	else if(t.tm_hour > r->dayAfter && t.tm_hour < r->dayBefore) {
 		tim = 'm';
 	}
 	else {
@@ -1644,8 +7184,8 @@ void TrainModel(item *endUser, char *country, struct tm t, float at, char status
 
 void detectFraud(item *endUser) {
 	
-	char status[10];
-	char location[30];
+	char status[16];
+	char location[32];
 	struct tm t;
 	float amount;
 	
@@ -1656,8 +7196,16 @@ void detectFraud(item *endUser) {
 		    
 	
 	FILE *fp = fopen(fileName, "r");
+	free(fileName);
+	
+	if(fp == NULL) {
+		printf(RED"\nNo recent transactions to check\n");
+		return;
+	}
+	
 	char *line;
 	line = getLine(&fp);
+	free(line);	// header
 	
 	countTime time_cat = {0,0,0,0,0,0,0,0};
 	countAmt amt_cat = {0,0,0,0,0,0,0,0};
@@ -1686,7 +7234,7 @@ void detectFraud(item *endUser) {
 		
 		token = strtok(NULL, " "); // Get the second token (location)
 		if (token != NULL) {
-			strcpy(location, token); // Copy to location
+			snprintf(location, sizeof(location), "%s", token); // Copy to location
 		}
 		
 		token = strtok(NULL, " "); // Get the third token (time)
@@ -1696,7 +7244,7 @@ void detectFraud(item *endUser) {
     		
     		token = strtok(NULL, " "); // Get the fourth token (status)
 		if (token != NULL) {
-			strcpy(status, token); // Copy to status
+			snprintf(status, sizeof(status), "%s", token); // Copy to status ("Successful" does not fit 10 bytes with its terminator)
 		}
 		
 		printf(CYAN"\n-----------------------\n");
@@ -1708,13 +7256,15 @@ void detectFraud(item *endUser) {
 		}
 		
 		else {
-			float zscore = (amount - endUser->mean)/(endUser->stdDev);
-			int isodd = is_odd_hour(t);
-				
-			if(fabs(zscore) > 3 || isodd == 1) {
+			const ruleConfig *r = ruleSettings();
+			float zscore = liveZScore(endUser, amount);
+			int isodd = (r->enabled & RULE_ODD) && is_odd_hour(t);
+			int outlier = (r->enabled & RULE_OUTLIER) && fabsf(zscore) >= r->outlierZ;	// the same test as RULE_OUTLIER
+			
+			if(outlier || isodd == 1) {
 				printf(RED"\nPotential Fraud Alert \n");
 				
-				if(fabs(zscore) > 3) {
+				if(outlier) {
 					printf(RED"Outlier detected : \n amount (zscore = %f) : %f \n", zscore, amount);
 				}
 				
@@ -1731,4 +7281,6 @@ void detectFraud(item *endUser) {
 	}
 	
 	free(line);
+	free(counts);
+	fclose(fp);
 }
@@ -3,8 +3,119 @@
 #include<time.h>
 #include"credit.h"
 #include<string.h>
+#include<unistd.h>
 
-int main() {
+int main(int argc, char *argv[]) {
+	
+	loadRuleConfig("rules.conf");	// the built-in rules when there is no rules.conf
+	loadZipTable("zipcodes.csv");	// without it every zip code is unknown and the travel rule never fires
+	
+	if(argc > 1 && strcmp(argv[1], "--selftest") == 0) {
+		
+		// ./credit --selftest : parsers, snapshots and lookups against each other on the shipped files, exit status 1 on a failure
+		return (selfTest() == 0) ? 0 : 1;
+	}
+	
+	if(argc > 2 && strcmp(argv[1], "--bench-parse") == 0) {
+		
+		// ./credit --bench-parse <file.csv> [rounds]
+		benchmarkParsers(argv[2], (argc > 3) ? atoi(argv[3]) : 5);
+		return 0;
+	}
+	
+	if(argc > 2 && strcmp(argv[1], "--bench-arena") == 0) {
+		
+		// ./credit --bench-arena <file.csv>
+		benchmarkArena(argv[2]);
+		return 0;
+	}
+	
+	if(argc > 1 && strcmp(argv[1], "--bench-dates") == 0) {
+		
+		// ./credit --bench-dates [n] [queries]
+		benchmarkDateIndex((argc > 2) ? atol(argv[2]) : 1000000, (argc > 3) ? atol(argv[3]) : 1000000);
+		return 0;
+	}
+	
+	if(argc > 1 && strcmp(argv[1], "--bench-features") == 0) {
+		
+		// ./credit --bench-features [n]
+		benchmarkFeatures((argc > 2) ? atol(argv[2]) : 10000000);
+		return 0;
+	}
+	
+	if(argc > 1 && strcmp(argv[1], "--bench-bursts") == 0) {
+		
+		// ./credit --bench-bursts [n] [burst]
+		benchmarkBursts((argc > 2) ? atol(argv[2]) : 200000, (argc > 3) ? atol(argv[3]) : 100000);
+		return 0;
+	}
+	
+	if(argc > 1 && strcmp(argv[1], "--bench-rules") == 0) {
+		
+		// ./credit --bench-rules [n] [rules file]
+		if(argc > 3 && loadRuleConfig(argv[3]) == -1) printf("Could not open %s \n", argv[3]);
+		benchmarkRules((argc > 2) ? atol(argv[2]) : 1000000);
+		return 0;
+	}
+	
+	if(argc > 1 && strcmp(argv[1], "--bench-travel") == 0) {
+		
+		// ./credit --bench-travel [n]
+		benchmarkTravel((argc > 2) ? atol(argv[2]) : 10000000);
+		return 0;
+	}
+	
+	if(argc > 1 && strcmp(argv[1], "--bench-map") == 0) {
+		
+		// ./credit --bench-map [n]
+		benchmarkMap((argc > 2) ? atol(argv[2]) : 10000000);
+		return 0;
+	}
+	
+	if(argc > 1 && strcmp(argv[1], "--bench-cmap") == 0) {
+		
+		// ./credit --bench-cmap [n] [maxThreads]
+		benchmarkConcurrentMap((argc > 2) ? atol(argv[2]) : 1000000, (argc > 3) ? atoi(argv[3]) : 64);
+		return 0;
+	}
+	
+	if(argc > 1 && strcmp(argv[1], "--build-index") == 0) {
+		
+		// ./credit --build-index [users.csv] [users.idx], run whenever users.csv changes
+		const char *usersName = (argc > 2) ? argv[2] : "users.csv";
+		const char *indexName = (argc > 3) ? argv[3] : "users.idx";
+		long n = buildUserIndex(usersName, indexName);
+		
+		if(n == -1) printf(RED "Could not build %s from %s\n", indexName, usersName);
+		else printf(CYAN "Indexed %ld users into %s\n", n, indexName);
+		return 0;
+	}
+	
+	if(argc > 1 && strcmp(argv[1], "--bench-index") == 0) {
+		
+		// ./credit --bench-index [n]
+		benchmarkUserIndex((argc > 2) ? atol(argv[2]) : 1000000);
+		return 0;
+	}
+	
+	if(argc > 2 && strcmp(argv[1], "--window-tx") == 0) {
+		
+		// interactive, z-scores against the last N successful transactions : ./credit --window-tx N
+		setProfileWindow(atol(argv[2]), 0);
+	}
+	
+	else if(argc > 2 && strcmp(argv[1], "--window-days") == 0) {
+		
+		// interactive, z-scores against the successful transactions of the last N days : ./credit --window-days N
+		setProfileWindow(0, atol(argv[2]));
+	}
+	
+	else if(argc > 2 && strcmp(argv[1], "--rules") == 0) {
+		
+		// interactive, with the rules of another file : ./credit --rules <file>
+		if(loadRuleConfig(argv[2]) == -1) printf("Could not open %s, using rules.conf \n", argv[2]);
+	}
 	
 	Map *m = initHashMap();
 	FILE *fp = fopen("users.csv", "r");
@@ -13,10 +124,43 @@ int main() {
 		printf("There was some error opening the file \n");
 	}
 	
-	else {
+	else if(argc > 1 && strcmp(argv[1], "--load-all") == 0) {
+		
+		// batch mode : ./credit --load-all [threads]
+		readUsersData(m, &fp);
+		
+		int threads = (argc > 2) ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+		bulkLoad(m, threads);
+	}
+	
+	else if(argc > 1 && strcmp(argv[1], "--sweep") == 0) {
+		
+		// nightly batch : ./credit --sweep [output.csv] [maxThreads]
+		readUsersData(m, &fp);
+		
+		int threads = (argc > 3) ? atoi(argv[3]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+		fraudSweep(m, (argc > 2) ? argv[2] : "flagged.csv", threads);
+	}
+	
+	else if(argc > 1 && strcmp(argv[1], "--serve") == 0) {
+		
+		// long running mode : ./credit --serve [budgetMB] < card numbers
 		readUsersData(m, &fp);
 		
-		int k = 0;
+		long budget = (argc > 2) ? atol(argv[2]) : CACHE_BUDGET_MB;
+		serveCards(initHistoryCache(m, budget * 1024 * 1024));
+	}
+	
+	else {
+		// unbuffered before the first read : follow mode select()s on the descriptor, input already buffered by stdio would be invisible to it
+		setvbuf(stdin, NULL, _IONBF, 0);
+		
+		// the prebuilt perfect hash index is used while it matches users.csv, otherwise every user is read into the map
+		userIndex *ix = openUserIndex("users.idx", "users.csv");
+		
+		if(ix == NULL) {
+			readUsersData(m, &fp);
+		}
 	
 		long int no;
 		int i = 0;
@@ -42,7 +186,11 @@ int main() {
 		
 		pass[i] = '\0';
 		
-		int result = checkUser(m, no, pass);
+		int result = (ix != NULL) ? indexCheckUser(ix, no, pass) : checkUser(m, no, pass);
+		
+		if(ix != NULL && result == 1) {
+			enter_users(m, *indexFind(ix, no));	// only the logged in user needs an item
+		}
 
 		if (result == 1) {
 		    
@@ -53,35 +201,25 @@ int main() {
 		    printf(YELLOW"\nCard No: %s\n",num);
 		    printf(YELLOW"\nCVV : %d\n",endUser->client.cvv);
 		    
-		    char *fileName = (char*)malloc(sizeof(char)*20);
-		    strcpy(fileName, endUser->client.name);
-		    
-		    strcat(fileName, ".csv");
-		    
-		    fp = fopen(fileName, "r");
+		    historyCache *cache = initHistoryCache(m, CACHE_BUDGET_MB * 1024L * 1024L);
+		    loadStats stats;
+		    cacheFind(cache, no, &stats);	// loads the history on first use
 		    
-		    if(fp == NULL) {
+		    if(!endUser->loaded) {
 		    	printf(RED "There was some error in loading the data \n");
 		    }
 		    
 		    else { 
 		    	
-		    	init_dll(&(endUser->list));
-		    	readCsv(&(endUser->list), &fp);
-		    	
-		    	node *head = copyList(endUser->list);
-		    	
-		    	endUser->root = sortedToBST(head);
-		    	endUser->mean = calculateMean(&(endUser->list));
-		    	endUser->stdDev = calculateStandardDeviation(&(endUser->list));
-		    	
-		    	free(head);
+		    	printf(CYAN "Loaded %ld transactions from %s (%.2f KB) in %.3f ms, %.2f MB/s\n", stats.rows, stats.source == 1 ? "snapshot" : "csv", stats.bytes / 1024.0, stats.seconds * 1000, throughputMBps(stats));
 		    	
 		    	int option;
 		    	while(1) {
 		
 				printMenu();
-				scanf("%d", &option);
+				if(scanf("%d", &option) != 1) {
+					break;	// end of input
+				}
 				int res = getInput(option, endUser->list, endUser);
 				if(res == 0) {
 					break;